@@ -0,0 +1,11 @@
+#!/bin/sh
+# Stands in for the Idris backend during load tests. It gets the same
+# "Origin | nick: .cmd args" argument and answers immediately.
+
+line="$*"
+msg="${line#*: }"
+case "$msg" in
+  .ping*) echo "=> pong" ;;
+  .*\ *) echo "=> ${msg#* }" ;;
+  *) echo "=> ${msg%% *}" ;;
+esac
@@ -0,0 +1,477 @@
+/*
+** bench.c | Digi's IRC Bot | Microbenchmarks.
+** https://github.com/davidgarland/digirc
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "digirc.h"
+
+/*
+** Allocation accounting. The bench is linked with --wrap for these, so every
+** allocation made by circa and the bot's own code lands here first.
+*/
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t m);
+void *__real_realloc(void *p, size_t n);
+
+static size_t allocs;
+static size_t alloc_bytes;
+
+void *__wrap_malloc(size_t n) {
+  allocs++;
+  alloc_bytes += n;
+  return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t n, size_t m) {
+  allocs++;
+  alloc_bytes += n * m;
+  return __real_calloc(n, m);
+}
+
+void *__wrap_realloc(void *p, size_t n) {
+  allocs++;
+  alloc_bytes += n;
+  return __real_realloc(p, n);
+}
+
+/*
+** Recorded traffic
+*/
+
+#define TRAFFIC_MAX 256
+
+static TxtBuf traffic;
+static TxtBuf lines[TRAFFIC_MAX];
+static size_t line_count;
+
+static void traffic_load(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "bench: can't open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  traffic = txtbuf_init();
+  txtbuf_alloc(&traffic, 4096);
+  TxtBuf line = txtbuf_init();
+  txtbuf_alloc(&line, 512);
+  bool eof = false;
+  while (!eof && (line_count < TRAFFIC_MAX)) {
+    eof = txtbuf_readline(&line, fp) == CE_EOF;
+    if (!line.len)
+      continue;
+    // The file is stored with plain newlines; the wire uses CRLF.
+    txtbuf_cat_cstr(&line, "\r\n");
+    txtbuf_cat(&traffic, &line);
+    lines[line_count] = txtbuf_init();
+    txtbuf_alloc(&lines[line_count], line.len + 1);
+    txtbuf_cpy(&lines[line_count], &line);
+    line_count++;
+  }
+  txtbuf_free(&line);
+  fclose(fp);
+}
+
+/*
+** Benchmarks
+*/
+
+static TxtBuf a, b, nick, msg;
+static FILE *traffic_fp;
+
+static void bench_push(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (a.len == 4095)
+      txtbuf_clear(&a);
+    txtbuf_push(&a, 'x');
+  }
+}
+
+static void bench_cat(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (a.len + b.len >= 4096)
+      txtbuf_clear(&a);
+    txtbuf_cat(&a, &b);
+  }
+}
+
+static void bench_fmt(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    txtbuf_fmt(&a, "%s => %s", "Digitalis", "[2,3,4]");
+}
+
+// The bot's reply shape, formatted the way it used to be and then built out of
+// typed appends; reply_vec sends the same line as segments over writev, and
+// stream_reply is the whole trip through a pager to a socket.
+static int null_fd;
+
+static void bench_reply_fmt(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    txtbuf_fmt(&a, "PRIVMSG %s :%s => %s\r\n", "#openredstone", nick.data, b.data);
+}
+
+static void bench_reply_cat(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    txtbuf_cpy_cstr(&a, "PRIVMSG #openredstone :");
+    txtbuf_cat(&a, &nick);
+    txtbuf_cat_cstr(&a, " => ");
+    txtbuf_cat(&a, &b);
+    txtbuf_cat_cstr(&a, "\r\n");
+  }
+}
+
+static void bench_cat_int(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    txtbuf_clear(&a);
+    txtbuf_cat_int(&a, -1234567 + (long long) i);
+  }
+}
+
+static IrcStream bench_st;
+
+static void bench_reply_vec(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    IrcVec v;
+    irc_vec_init(&v);
+    irc_vec_cstr(&v, "PRIVMSG #openredstone :");
+    irc_vec_add(&v, nick.data, nick.len);
+    irc_vec_cstr(&v, " => ");
+    irc_vec_add(&v, b.data, b.len);
+    irc_say(null_fd, &v);
+  }
+}
+
+static void bench_stream_reply(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    irc_stream_begin(&bench_st, null_fd, "#openredstone", nick.data, " => ");
+    irc_stream_feed(&bench_st, b.data, b.len);
+    irc_stream_end(&bench_st);
+  }
+}
+
+static void bench_read(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    rewind(traffic_fp);
+    txtbuf_read(&a, traffic_fp);
+  }
+}
+
+static void bench_readline(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    if (txtbuf_readline(&a, traffic_fp) == CE_EOF)
+      rewind(traffic_fp);
+}
+
+static void bench_cpy_slice(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    txtbuf_cpy_slice(&a, &b, (Slice) {8, 39});
+}
+
+static void bench_irc_line(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (!irc_rx_line(&irc_rx, &a)) {
+      irc_rx_feed(&irc_rx, traffic.data, traffic.len);
+      irc_rx_line(&irc_rx, &a);
+    }
+  }
+}
+
+static void bench_irc_info(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    irc_info(&lines[i % line_count], &nick, &msg);
+}
+
+static void bench_shell_esc(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    shell_esc(&a, &lines[i % line_count]);
+}
+
+// The UTF-8 benches all run over the whole traffic blob; memcpy of the same
+// bytes is the floor they are measured against.
+static void bench_memcpy(size_t n) {
+  txtbuf_prealloc(&a, traffic.len + 1);
+  for (size_t i = 0; i < n; i++) {
+    memcpy(a.data, traffic.data, traffic.len);
+    __asm__ volatile("" : : "r"(a.data) : "memory");
+  }
+}
+
+static volatile bool valid_sink;
+
+static void bench_utf8_valid(size_t n) {
+  bool ok;
+  for (size_t i = 0; i < n; i++) {
+    txtbuf_utf8_valid(&traffic, &ok);
+    valid_sink = ok;
+  }
+}
+
+static void bench_utf8_upper(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    txtbuf_cpy(&a, &traffic);
+    txtbuf_utf8_upper(&a);
+  }
+}
+
+// Arms a spread of deadlines and cancels them again, which is a job's whole
+// life when it finishes in time.
+#define BENCH_TIMERS 1024
+
+static Timer bench_timers[BENCH_TIMERS];
+
+static void bench_timer_nop(Timer *t) {
+  (void) t;
+}
+
+static void bench_timer(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    Timer *t = &bench_timers[i % BENCH_TIMERS];
+    t->fn = bench_timer_nop;
+    timer_arm(t, 30000 + (i % 977) * 50);
+    if ((i % BENCH_TIMERS) == BENCH_TIMERS - 1)
+      for (size_t k = 0; k < BENCH_TIMERS; k++)
+        timer_cancel(&bench_timers[k]);
+  }
+}
+
+// A backend command both ways: spawned the way the bot runs a job (a shell,
+// the quoted message, the whole answer read back), and as a call into the
+// linked backend when the bench is built with IDRIS=1. Without ./backend the
+// spawn goes to the stub, which is the cheapest a spawned backend can be.
+static const char *backend_path;
+
+static void bench_backend_spawn(size_t n) {
+  extern char **environ;
+  char buf[512];
+  for (size_t i = 0; i < n; i++) {
+    txtbuf_cpy_cstr(&a, "IRC | Digitalis: .say hello there");
+    shell_esc(&b, &a);
+    txtbuf_cpy_cstr(&a, (char *) backend_path);
+    txtbuf_cat_char(&a, ' ');
+    txtbuf_cat(&a, &b);
+
+    int fds[2];
+    if (pipe(fds))
+      return;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&fa, fds[0]);
+    char *argv[] = {"/bin/sh", "-c", a.data, NULL};
+    pid_t pid;
+    posix_spawn(&pid, "/bin/sh", &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    while (read(fds[0], buf, sizeof(buf)) > 0);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+  }
+  txtbuf_cpy_cstr(&b, "Digitalis => fmap (+ 1) [1, 2, 3] => [2,3,4]");
+}
+
+#ifdef DIGIRC_IDRIS
+static void bench_backend_ffi(size_t n) {
+  for (size_t i = 0; i < n; i++)
+    backend_run("IRC", "Digitalis", ".say", "hello there", &a);
+}
+#endif
+
+static volatile enum cmd sink;
+
+static void bench_dispatch(size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    irc_info(&lines[i % line_count], &nick, &msg);
+    sink = irc_dispatch(&nick, &msg);
+  }
+}
+
+typedef struct {
+  const char *name;
+  void (*fn)(size_t n);
+} Bench;
+
+static const Bench benches[] = {
+  {"txtbuf_push", bench_push},
+  {"txtbuf_cat", bench_cat},
+  {"txtbuf_fmt", bench_fmt},
+  {"txtbuf_cat_int", bench_cat_int},
+  {"reply_fmt", bench_reply_fmt},
+  {"reply_cat", bench_reply_cat},
+  {"reply_vec", bench_reply_vec},
+  {"stream_reply", bench_stream_reply},
+  {"txtbuf_read", bench_read},
+  {"txtbuf_readline", bench_readline},
+  {"txtbuf_cpy_slice", bench_cpy_slice},
+  {"irc_line", bench_irc_line},
+  {"irc_info", bench_irc_info},
+  {"shell_esc", bench_shell_esc},
+  {"dispatch", bench_dispatch},
+  {"timer_arm_cancel", bench_timer},
+  {"backend_spawn", bench_backend_spawn},
+#ifdef DIGIRC_IDRIS
+  {"backend_ffi", bench_backend_ffi},
+#endif
+  {"memcpy", bench_memcpy},
+  {"utf8_valid", bench_utf8_valid},
+  {"utf8_upper", bench_utf8_upper},
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+/*
+** Runner
+*/
+
+typedef struct {
+  const char *name;
+  double ns_op;
+  double allocs_op;
+  double bytes_op;
+} Result;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static Result bench_run(const Bench *bn) {
+  // Warm up buffers, then grow the iteration count until one pass takes long
+  // enough to time reliably. The best of five passes is reported.
+  size_t n = 1;
+  bn->fn(64);
+  while (true) {
+    double t = now_ns();
+    bn->fn(n);
+    if (now_ns() - t > 2e7)
+      break;
+    n *= 2;
+  }
+
+  Result r = {bn->name, 1e300, 0, 0};
+  for (int pass = 0; pass < 5; pass++) {
+    size_t a0 = allocs, b0 = alloc_bytes;
+    double t = now_ns();
+    bn->fn(n);
+    double ns = (now_ns() - t) / n;
+    if (ns < r.ns_op)
+      r.ns_op = ns;
+    r.allocs_op = (double) (allocs - a0) / n;
+    r.bytes_op = (double) (alloc_bytes - b0) / n;
+  }
+  return r;
+}
+
+/*
+** Baseline comparison. The baseline is just an earlier run's output; a result
+** regresses when it is slower than the threshold allows or allocates more.
+*/
+
+static int bench_compare(const char *path, Result *rs, size_t n, double threshold) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "bench: no baseline at %s\n", path);
+    return 0;
+  }
+
+  int regressions = 0;
+  char name[64];
+  double ns, al, by;
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    if ((line[0] == '#') || (sscanf(line, "%63s %lf %lf %lf", name, &ns, &al, &by) != 4))
+      continue;
+    for (size_t i = 0; i < n; i++) {
+      if (strcmp(rs[i].name, name))
+        continue;
+      bool slow = rs[i].ns_op > ns * threshold;
+      bool fat = rs[i].allocs_op > al + 0.01;
+      fprintf(stderr, "%-18s %10.2f -> %10.2f ns/op (%+6.1f%%)%s\n", name, ns, rs[i].ns_op,
+        (rs[i].ns_op / ns - 1) * 100, (slow || fat) ? "  REGRESSION" : "");
+      regressions += slow || fat;
+    }
+  }
+  fclose(fp);
+  return regressions;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: bench [-o out.tsv] [-b baseline.tsv] [-t threshold] [-f traffic.txt] [filter]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  const char *base_path = NULL;
+  const char *traffic_path = "bench/traffic.txt";
+  double threshold = 1.15;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:b:t:f:")) != -1) {
+    switch (opt) {
+      case 'o': out_path = optarg; break;
+      case 'b': base_path = optarg; break;
+      case 't': threshold = atof(optarg); break;
+      case 'f': traffic_path = optarg; break;
+      default: usage();
+    }
+  }
+  const char *filter = optind < argc ? argv[optind] : NULL;
+
+  // The bot logs to stdout; keep that out of the results.
+  FILE *out = out_path ? fopen(out_path, "w") : fdopen(dup(STDOUT_FILENO), "w");
+  if (!out)
+    usage();
+  freopen("/dev/null", "w", stdout);
+
+  bridge_load("bridges.conf");
+  traffic_load(traffic_path);
+
+  irc_rx_init(&irc_rx);
+  timer_init();
+  traffic_fp = fmemopen(traffic.data, traffic.len, "r");
+
+  a = txtbuf_init();
+  b = txtbuf_init();
+  nick = txtbuf_init();
+  msg = txtbuf_init();
+  txtbuf_alloc(&a, 1);
+  txtbuf_alloc(&b, 1);
+  txtbuf_alloc(&nick, 1);
+  txtbuf_alloc(&msg, 1);
+  txtbuf_cpy_cstr(&b, "Digitalis => fmap (+ 1) [1, 2, 3] => [2,3,4]");
+  txtbuf_cpy_cstr(&nick, "Digitalis");
+  irc_stream_init(&bench_st, IRC_LINE_CAP);
+  null_fd = open("/dev/null", O_WRONLY);
+  backend_path = getenv("DIGIRC_BACKEND");
+  if (!backend_path)
+    backend_path = access("backend", X_OK) ? "bench/backend-stub.sh" : "./backend";
+  backend_init();
+
+  Result rs[BENCH_COUNT];
+  size_t n = 0;
+  fprintf(out, "# name\tns_op\tallocs_op\tbytes_op\n");
+  for (size_t i = 0; i < BENCH_COUNT; i++) {
+    if (filter && !strstr(benches[i].name, filter))
+      continue;
+    rs[n] = bench_run(&benches[i]);
+    fprintf(out, "%s\t%.2f\t%.3f\t%.1f\n", rs[n].name, rs[n].ns_op, rs[n].allocs_op, rs[n].bytes_op);
+    fflush(out);
+    n++;
+  }
+  fclose(out);
+
+  fprintf(stderr, "bench: %s kernels\n", txtbuf_kernels()->name);
+  if (base_path && bench_compare(base_path, rs, n, threshold))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
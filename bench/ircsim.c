@@ -0,0 +1,335 @@
+/*
+** ircsim.c | Digi's IRC Bot | Local IRC server stand-in and load generator.
+** https://github.com/davidgarland/digirc
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define CHANNEL "#openredstone"
+#define LINE_MAX_ 512
+
+/*
+** Traffic. Each entry is one message body and whether it should arrive
+** through a relay bot. Commands get a unique sender ("load<N>") so that the
+** reply, which starts with the sender's nick, can be matched back to it.
+*/
+
+typedef struct {
+  char *text;
+  bool relay;
+} Entry;
+
+static Entry *entries;
+static size_t entry_count;
+
+static const char *synth_cmds[] = {
+  ".ping", ".say hello there", ".yell keep it down", ".mock why has everyone comed up with ideas before me",
+  ".rpn 2 3 + 4 *", ".quote 46", ".whoami", ".aesthetic vapor", ".spanish hola amigo",
+};
+
+static const char *synth_chat[] = {
+  "anyone around to review my ALU?", "whats ur most diagonal cca", "enigma balls",
+  "don't use 'String' for that, it's a linked list", "i Reside In The s T a T e S.... !",
+  "also the more immutable values you have the worse peformance unless it does an so odd hack",
+};
+
+#define ARRAY_LEN(A) (sizeof(A) / sizeof((A)[0]))
+
+static void entry_add(const char *text, bool relay) {
+  entries = realloc(entries, (entry_count + 1) * sizeof(Entry));
+  entries[entry_count++] = (Entry) {strdup(text), relay};
+}
+
+// Pulls the message bodies out of recorded PRIVMSG lines, undoing the relay
+// prefix ("[N] nick: ") on lines that came through a bridge.
+static void traffic_load(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "ircsim: can't open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  char line[LINE_MAX_ + 2];
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *body = strstr(line, " PRIVMSG ");
+    if (!body || !(body = strstr(body, " :")))
+      continue;
+    body += 2;
+    bool relay = !strncmp(line, ":ORE", 4);
+    if (relay) {
+      char *colon = strstr(body, ": ");
+      if (!colon)
+        continue;
+      body = colon + 2;
+    }
+    entry_add(body, relay);
+  }
+  fclose(fp);
+}
+
+static void traffic_synth(size_t n, double cmd_ratio, double relay_ratio) {
+  for (size_t i = 0; i < n; i++) {
+    bool cmd = rand() < cmd_ratio * RAND_MAX;
+    bool relay = rand() < relay_ratio * RAND_MAX;
+    entry_add(cmd ? synth_cmds[rand() % ARRAY_LEN(synth_cmds)] : synth_chat[rand() % ARRAY_LEN(synth_chat)], relay);
+  }
+}
+
+/*
+** Connection
+*/
+
+static int conn;
+static char rbuf[1 << 16];
+static size_t rlen;
+static bool slow; // Read a little at a time, so the bot's socket stays full.
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void send_line(const char *fmt, ...) {
+  char buf[LINE_MAX_ + 1];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len > LINE_MAX_)
+    len = LINE_MAX_;
+  if (write(conn, buf, len) != len) {
+    perror("ircsim: write");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Returns the next complete line from the bot (without CRLF), or NULL if one
+// hasn't arrived within timeout seconds.
+static char *recv_line(double timeout) {
+  static char line[sizeof(rbuf)];
+  double until = now_s() + timeout;
+  while (true) {
+    char *nl = memchr(rbuf, '\n', rlen);
+    if (nl) {
+      size_t n = nl - rbuf + 1;
+      memcpy(line, rbuf, n);
+      line[n - 1] = '\0';
+      if (n >= 2 && line[n - 2] == '\r')
+        line[n - 2] = '\0';
+      memmove(rbuf, rbuf + n, rlen - n);
+      rlen -= n;
+      return line;
+    }
+    double left = until - now_s();
+    if (left <= 0)
+      return NULL;
+    struct pollfd pfd = {conn, POLLIN, 0};
+    if (poll(&pfd, 1, (int) (left * 1000) + 1) <= 0)
+      continue;
+    if (slow)
+      usleep(1000);
+    ssize_t got = read(conn, rbuf + rlen, slow ? 1024 : sizeof(rbuf) - rlen);
+    if (got <= 0) {
+      fprintf(stderr, "ircsim: bot disconnected\n");
+      exit(EXIT_FAILURE);
+    }
+    rlen += got;
+  }
+}
+
+static char *expect(const char *prefix, double timeout) {
+  char *line;
+  while ((line = recv_line(timeout))) {
+    if (!strncmp(line, prefix, strlen(prefix)))
+      return line;
+  }
+  fprintf(stderr, "ircsim: timed out waiting for %s\n", prefix);
+  exit(EXIT_FAILURE);
+}
+
+// Walks the bot through the same sequence esper.net does: an initial PING,
+// a welcome, the NickServ identify round trip, then the channel join.
+static void registration(void) {
+  expect("NICK", 10);
+  send_line("PING :ircsim\r\n");
+  expect("PONG", 10);
+  send_line(":digirc MODE digirc :+i\r\n");
+  expect("PRIVMSG NickServ", 10);
+  send_line(":NickServ!NickServ@services. NOTICE digirc :You are now identified for digirc.\r\n");
+  expect("JOIN " CHANNEL, 10);
+  send_line(":digirc!~digirc@localhost JOIN " CHANNEL "\r\n");
+}
+
+/*
+** Load
+*/
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double pct(double *xs, size_t n, double p) {
+  if (!n)
+    return 0;
+  size_t i = (size_t) (p * (n - 1) + 0.5);
+  return xs[i];
+}
+
+static void usage(void) {
+  fprintf(stderr,
+    "usage: ircsim [-p port] [-r lines/s] [-d seconds] [-f traffic.txt]\n"
+    "              [-c command ratio] [-R relay ratio] [-g grace seconds]\n"
+    "              [-b receive buffer bytes] [-s stall seconds]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  int port = 6667;
+  double rate = 50;
+  double duration = 10;
+  double grace = 5;
+  double cmd_ratio = 0.3;
+  double relay_ratio = 0.3;
+  const char *path = NULL;
+  int rcvbuf = 0;
+  double stall = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:r:d:f:c:R:g:b:s:")) != -1) {
+    switch (opt) {
+      case 'p': port = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'f': path = optarg; break;
+      case 'c': cmd_ratio = atof(optarg); break;
+      case 'R': relay_ratio = atof(optarg); break;
+      case 'g': grace = atof(optarg); break;
+      case 'b': rcvbuf = atoi(optarg); break;
+      case 's': stall = atof(optarg); break;
+      default: usage();
+    }
+  }
+  if (rate <= 0 || duration <= 0)
+    usage();
+
+  srand(1);
+  if (path)
+    traffic_load(path);
+  else
+    traffic_synth(1024, cmd_ratio, relay_ratio);
+  if (!entry_count)
+    usage();
+
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  // A small receive window, set before the connection exists so that it
+  // sticks, a stall in reading and slow reads after it make the bot's sends
+  // come up short.
+  if (rcvbuf)
+    setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+  };
+  if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) || listen(lfd, 1)) {
+    perror("ircsim: bind");
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "ircsim: listening on 127.0.0.1:%d\n", port);
+  conn = accept(lfd, NULL, NULL);
+  setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  registration();
+  fprintf(stderr, "ircsim: bot registered, sending %.0f lines/s for %.0fs\n", rate, duration);
+
+  size_t total = (size_t) (rate * duration);
+  double *sent_at = calloc(total, sizeof(double));
+  double *lat = calloc(total, sizeof(double));
+  size_t cmds = 0, replies = 0, reordered = 0, last_id = 0;
+  double last_reply = 0;
+
+  double start = now_s();
+  size_t i = 0;
+  while (true) {
+    double t = now_s();
+    if (i < total && t >= start + i / rate) {
+      Entry *e = &entries[i % entry_count];
+      bool cmd = e->text[0] == '.';
+      char nick[32];
+      if (cmd) {
+        snprintf(nick, sizeof(nick), "load%zu", i);
+        sent_at[i] = t;
+        cmds++;
+      } else {
+        snprintf(nick, sizeof(nick), "user%zu", i % 97);
+      }
+      if (e->relay)
+        send_line(":ORENetwork!~ore@openredstone/bot PRIVMSG " CHANNEL " :\x03" "14%s\x0f: %s\r\n", nick, e->text);
+      else
+        send_line(":%s!~%s@sim PRIVMSG " CHANNEL " :%s\r\n", nick, nick, e->text);
+      i++;
+      continue;
+    }
+    if (i >= total && (t > start + duration + grace || replies == cmds))
+      break;
+
+    double wait = i < total ? start + i / rate - t : start + duration + grace - t;
+    if (t < start + stall) {
+      usleep((wait > 0 ? wait : 0) * 1e6);
+      continue;
+    }
+    slow = stall > 0;
+    char *line = recv_line(wait > 0 ? wait : 0);
+    if (!line)
+      continue;
+    if (!strncmp(line, "PING ", 5)) {
+      send_line(":ircsim PONG ircsim %s\r\n", line + 5);
+      continue;
+    }
+    const char *tag = "PRIVMSG " CHANNEL " :load";
+    if (strncmp(line, tag, strlen(tag)))
+      continue;
+    size_t id = strtoul(line + strlen(tag), NULL, 10);
+    if (id < total && sent_at[id] > 0) {
+      // Commands answered in-process reply in the order they were sent, so
+      // an earlier id after a later one means the bot reordered its output.
+      if (id < last_id)
+        reordered++;
+      last_id = id;
+      lat[replies++] = now_s() - sent_at[id];
+      sent_at[id] = -1;
+      last_reply = now_s();
+    }
+  }
+
+  qsort(lat, replies, sizeof(double), cmp_double);
+  double span = (last_reply > start ? last_reply : now_s()) - start;
+  printf("lines\t%zu\n", i);
+  printf("commands\t%zu\n", cmds);
+  printf("replies\t%zu\n", replies);
+  printf("unanswered\t%zu\n", cmds - replies);
+  printf("reordered\t%zu\n", reordered);
+  printf("offered_lines_per_s\t%.1f\n", rate);
+  printf("commands_per_s\t%.1f\n", span > 0 ? replies / span : 0);
+  printf("latency_p50_ms\t%.3f\n", pct(lat, replies, 0.50) * 1e3);
+  printf("latency_p90_ms\t%.3f\n", pct(lat, replies, 0.90) * 1e3);
+  printf("latency_p99_ms\t%.3f\n", pct(lat, replies, 0.99) * 1e3);
+  printf("latency_max_ms\t%.3f\n", replies ? lat[replies - 1] * 1e3 : 0);
+
+  close(conn);
+  close(lfd);
+  return EXIT_SUCCESS;
+}
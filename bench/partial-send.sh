@@ -0,0 +1,27 @@
+#!/bin/sh
+# Checks that the bot's output stays in order when its sends come up short.
+# The simulated server shrinks its receive window and stops reading for a
+# while, so the bot's socket fills and sends only partly complete; every
+# command is a long .say from the basic plugin, answered in-process and so in
+# the order it was sent. Run from the repository root after `make` and
+# `make sim`; pass DIGIRC_IO=poll to check the poll engine instead.
+
+port=${PORT:-7778}
+traffic=$(mktemp)
+out=$(mktemp)
+trap 'rm -f "$traffic" "$out"' EXIT
+
+pad=$(printf '%0400d' 0 | tr 0 x)
+for i in 1 2 3 4 5 6 7 8; do
+  echo ":t!t@sim PRIVMSG #openredstone :.say $i $pad" >> "$traffic"
+done
+
+./ircsim.out -p "$port" -r 2000 -d 12 -g 30 -b 4096 -s 6 -f "$traffic" > "$out" &
+sim=$!
+sleep 0.3
+DIGIRC_HOST=127.0.0.1 DIGIRC_PORT="$port" DIGIRC_FLOOD_BURST=0 \
+  timeout 60 ./a.out > /dev/null 2>&1
+wait "$sim"
+
+cat "$out"
+grep -q '^unanswered	0$' "$out" && grep -q '^reordered	0$' "$out"
@@ -16,6 +16,11 @@
 
 #include <circa_core.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && !defined(CIRCA_NO_SIMD)
+  #define CIRCA_TXTBUF_X86
+  #include <immintrin.h>
+#endif
+
 /*
 ** Type Definitions
 */
@@ -39,6 +44,13 @@ for (size_t I = 0, J = 0; I < (XS)->len; I++, J = 0) \
 for (char it; (txtbuf_get(XS, I, &it), J != 1); J = 1) \
 E
 
+#define txtbuf_foreach_span(P, N, W, XS) \
+for (size_t I = 0, N = 0; (N = (XS)->len - I < (W) ? (XS)->len - I : (W)), I < (XS)->len; I += N) \
+for (char *P = (XS)->data + I; P; P = NULL)
+
+#define txtbuf_foreach_token(S, C, XS) \
+for (Slice S = txtbuf_token(XS, C, 0); S.r < (XS)->len; S = txtbuf_token(XS, C, S.r + 1))
+
 /*
 ** Forward Declarations
 */
@@ -73,6 +85,9 @@ CIRCA CE txtbuf_cat(TxtBuf *dst, TxtBuf *src);
 CIRCA CE txtbuf_cat_slice(TxtBuf *dst, TxtBuf *src, Slice s);
 CIRCA CE txtbuf_cat_cstr(TxtBuf *dst, char *src);
 CIRCA CE txtbuf_cat_cstr_slice(TxtBuf *dst, char *src, Slice s);
+CIRCA CE txtbuf_cat_mem(TxtBuf *dst, const void *src, size_t len);
+CIRCA CE txtbuf_cat_char(TxtBuf *dst, char c);
+CIRCA CE txtbuf_cat_int(TxtBuf *dst, long long v);
 
 CIRCA CIRCA_VPRINTF(2) CE txtbuf_fmt_va(TxtBuf *tb, const char *fmt, va_list ap);
 CIRCA CIRCA_VPRINTF(2) CE txtbuf_fmt(TxtBuf *tb, const char *fmt, ...);
@@ -89,6 +104,18 @@ CIRCA CE txtbuf_cat_readline(TxtBuf *tb, FILE *fp);
 CIRCA CE txtbuf_readfile(TxtBuf *tb, FILE *fp);
 CIRCA CE txtbuf_cat_readfile(TxtBuf *tb, FILE *fp);
 
+/* String Algorithms */
+
+CIRCA CE txtbuf_find(TxtBuf *tb, size_t from, char c, size_t *r);
+CIRCA CE txtbuf_find_cstr(TxtBuf *tb, size_t from, char *needle, size_t *r);
+CIRCA CE txtbuf_count(TxtBuf *tb, char c, size_t *r);
+CIRCA Slice txtbuf_token(TxtBuf *tb, char c, size_t from);
+CIRCA CE txtbuf_split(TxtBuf *tb, char c, Slice *out, size_t max, size_t *n);
+CIRCA CE txtbuf_replace(TxtBuf *tb, char *from, char *to);
+CIRCA CE txtbuf_upper(TxtBuf *tb);
+CIRCA CE txtbuf_lower(TxtBuf *tb);
+CIRCA CE txtbuf_cat_escape(TxtBuf *dst, TxtBuf *src, char c, char *rep);
+
 /*
 ** Allocators
 */
@@ -135,7 +162,7 @@ CE txtbuf_prealloc(TxtBuf *tb, size_t cap) {
 
 CIRCA
 CE txtbuf_shrink(TxtBuf *tb) {
-  txtbuf_realloc(tb, tb->len + 1);
+  return txtbuf_realloc(tb, tb->len + 1);
 }
 
 CIRCA
@@ -145,6 +172,7 @@ CE txtbuf_free(TxtBuf *tb) {
   tb->len = 0;
   free(tb->data);
   tb->data = NULL;
+  return CE_OK;
 }
 
 /*
@@ -228,7 +256,7 @@ CE txtbuf_cpy(TxtBuf *dst, TxtBuf *src) {
   CE req_fail = txtbuf_prealloc(dst, len + 1);
   if (req_fail)
     return req_fail;
-  memcpy(dst->data, src, len + 1); // Null terminates
+  memcpy(dst->data, src->data, len + 1); // Null terminates
   dst->len = len;
   return CE_OK;
 }
@@ -239,7 +267,7 @@ CE txtbuf_cpy_slice(TxtBuf *dst, TxtBuf *src, Slice s) {
   CE_CHECK(!dst->data, CE_NULL_ARG);
   CE_CHECK(!src, CE_NULL_ARG);
   CE_CHECK(!src->data, CE_NULL_ARG);
-  CE_CHECK(!slice_contains(s, (Slice) {0, src->len}), CE_OOB);
+  CE_CHECK(!slice_contains((Slice) {0, src->len}, s), CE_OOB);
   size_t s_len = slice_len(s);
   CE req_fail = txtbuf_prealloc(dst, s_len + 1);
   if (req_fail)
@@ -269,7 +297,7 @@ CE txtbuf_cpy_cstr_slice(TxtBuf *dst, char *src, Slice s) {
   CE_CHECK(!dst, CE_NULL_ARG);
   CE_CHECK(!dst->data, CE_NULL_ARG);
   CE_CHECK(!src, CE_NULL_ARG);
-  CE_CHECK(!slice_contains(s, (Slice) {0, strlen(src)}), CE_OOB);
+  CE_CHECK(!slice_contains((Slice) {0, strlen(src)}, s), CE_OOB);
   size_t s_len = slice_len(s);
   CE req_fail = txtbuf_prealloc(dst, s_len + 1);
   if (req_fail)
@@ -287,11 +315,11 @@ CE txtbuf_cat(TxtBuf *dst, TxtBuf *src) {
   CE_CHECK(!src, CE_NULL_ARG);
   CE_CHECK(!src->data, CE_NULL_ARG);
   size_t len = src->len;
-  CE req_fail = txtbuf_prealloc(dst, dst->len + src->len + 1);
+  CE req_fail = txtbuf_prealloc(dst, dst->len + len + 1);
   if (req_fail)
     return req_fail;
-  memcpy(dst + dst->len, src, src->len + 1); // Null terminates
-  dst->len += src->len;
+  memcpy(dst->data + dst->len, src->data, len + 1); // Null terminates
+  dst->len += len;
   return CE_OK;
 }
 
@@ -301,14 +329,14 @@ CE txtbuf_cat_slice(TxtBuf *dst, TxtBuf *src, Slice s) {
   CE_CHECK(!dst->data, CE_NULL_ARG);
   CE_CHECK(!src, CE_NULL_ARG);
   CE_CHECK(!src->data, CE_NULL_ARG);
-  CE_CHECK(!slice_contains(s, (Slice) {0, strlen(src)}), CE_OOB);
+  CE_CHECK(!slice_contains((Slice) {0, src->len}, s), CE_OOB);
   size_t s_len = slice_len(s);
   CE req_fail = txtbuf_prealloc(dst, dst->len + s_len + 1);
   if (req_fail)
     return req_fail;
   memcpy(dst->data + dst->len, src->data + s.l, s_len);
   dst->len += s_len;
-  dst->data[s_len] = '\0';
+  dst->data[dst->len] = '\0';
   return CE_OK;
 }
 
@@ -331,14 +359,66 @@ CE txtbuf_cat_cstr_slice(TxtBuf *dst, char *src, Slice s) {
   CE_CHECK(!dst, CE_NULL_ARG);
   CE_CHECK(!dst->data, CE_NULL_ARG);
   CE_CHECK(!src, CE_NULL_ARG);
-  CE_CHECK(!slice_contains(s, (Slice) {0, strlen(src)}), CE_OOB);
+  CE_CHECK(!slice_contains((Slice) {0, strlen(src)}, s), CE_OOB);
   size_t s_len = slice_len(s);
   CE req_fail = txtbuf_prealloc(dst, dst->len + s_len + 1);
   if (req_fail)
     return req_fail;
   memcpy(dst->data + dst->len, src + s.l, s_len);
   dst->len += s_len;
-  dst->data[s_len] = '\0';
+  dst->data[dst->len] = '\0';
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_cat_mem(TxtBuf *dst, const void *src, size_t len) {
+  CE_CHECK(!dst, CE_NULL_ARG);
+  CE_CHECK(!dst->data, CE_NULL_ARG);
+  CE_CHECK(!src && len, CE_NULL_ARG);
+  CE req_fail = txtbuf_prealloc(dst, dst->len + len + 1);
+  if (req_fail)
+    return req_fail;
+  if (len)
+    memcpy(dst->data + dst->len, src, len);
+  dst->len += len;
+  dst->data[dst->len] = '\0';
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_cat_char(TxtBuf *dst, char c) {
+  CE_CHECK(!dst, CE_NULL_ARG);
+  CE_CHECK(!dst->data, CE_NULL_ARG);
+  CE req_fail = txtbuf_prealloc(dst, dst->len + 2);
+  if (req_fail)
+    return req_fail;
+  dst->data[dst->len++] = c;
+  dst->data[dst->len] = '\0';
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_cat_int(TxtBuf *dst, long long v) {
+  CE_CHECK(!dst, CE_NULL_ARG);
+  CE_CHECK(!dst->data, CE_NULL_ARG);
+  // Digits come out backwards, so they're written from the end of a scratch
+  // buffer big enough for any 64 bit value and its sign.
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  unsigned long long u = v < 0 ? -(unsigned long long) v : (unsigned long long) v;
+  do {
+    *--p = '0' + (u % 10);
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    *--p = '-';
+  size_t len = buf + sizeof(buf) - p;
+  CE req_fail = txtbuf_prealloc(dst, dst->len + len + 1);
+  if (req_fail)
+    return req_fail;
+  memcpy(dst->data + dst->len, p, len);
+  dst->len += len;
+  dst->data[dst->len] = '\0';
   return CE_OK;
 }
 
@@ -347,16 +427,8 @@ CE txtbuf_fmt_va(TxtBuf *tb, const char *fmt, va_list ap) {
   CE_CHECK(!tb, CE_NULL_ARG);
   CE_CHECK(!tb->data, CE_NULL_ARG);
   CE_CHECK(!fmt, CE_NULL_ARG);
-  va_list ap2;
-  va_copy(ap2, ap);
-  size_t len = vsnprintf(NULL, 0, fmt, ap2);
-  va_end(ap2);
-  CE req_fail = txtbuf_prealloc(tb, len + 1);
-  if (req_fail)
-    return req_fail;
-  vsnprintf(tb->data, len + 1, fmt, ap); // Null terminates
-  tb->len = len;
-  return CE_OK;
+  tb->len = 0;
+  return txtbuf_cat_fmt_va(tb, fmt, ap);
 }
 
 CIRCA CIRCA_PRINTF(2)
@@ -375,14 +447,23 @@ CE txtbuf_cat_fmt_va(TxtBuf *tb, const char *fmt, va_list ap) {
   CE_CHECK(!tb, CE_NULL_ARG);
   CE_CHECK(!tb->data, CE_NULL_ARG);
   CE_CHECK(!fmt, CE_NULL_ARG);
+  // Format straight into the spare capacity; only output that doesn't fit
+  // costs a second pass, after growing to the size the first one reported.
+  size_t room = tb->cap - tb->len;
   va_list ap2;
   va_copy(ap2, ap);
-  size_t len = vsnprintf(NULL, 0, fmt, ap2);
+  int len = vsnprintf(tb->data + tb->len, room, fmt, ap2);
   va_end(ap2);
-  CE req_fail = txtbuf_prealloc(tb, tb->len + len + 1);
-  if (req_fail)
-    return req_fail;
-  vsnprintf(tb->data + tb->len, len + 1, fmt, ap); // Null terminates
+  if (len < 0) {
+    tb->data[tb->len] = '\0';
+    return CE_FMT;
+  }
+  if ((size_t) len >= room) {
+    CE req_fail = txtbuf_prealloc(tb, tb->len + len + 1);
+    if (req_fail)
+      return req_fail;
+    vsnprintf(tb->data + tb->len, len + 1, fmt, ap); // Null terminates
+  }
   tb->len += len;
   return CE_OK;
 }
@@ -508,4 +589,333 @@ CE txtbuf_cat_readfile(TxtBuf *tb, FILE *fp) {
   return CE_OK;
 }
 
+/*
+** String Algorithms
+*/
+
+/* Kernels */
+
+typedef struct {
+  const char *name;
+  size_t (*find)(const char *s, size_t len, char c);
+  size_t (*count)(const char *s, size_t len, char c);
+  void (*flip)(char *s, size_t len, char lo, char hi);
+} TxtBufKernels;
+
+CIRCA
+size_t txtbuf_find_scalar(const char *s, size_t len, char c) {
+  const char *p = memchr(s, c, len);
+  return p ? (size_t) (p - s) : len;
+}
+
+CIRCA
+size_t txtbuf_count_scalar(const char *s, size_t len, char c) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++)
+    n += s[i] == c;
+  return n;
+}
+
+CIRCA
+void txtbuf_flip_scalar(char *s, size_t len, char lo, char hi) {
+  for (size_t i = 0; i < len; i++)
+    if ((unsigned char) (s[i] - lo) <= (unsigned char) (hi - lo))
+      s[i] ^= 0x20;
+}
+
+#ifdef CIRCA_TXTBUF_X86
+
+CIRCA
+size_t txtbuf_find_sse2(const char *s, size_t len, char c) {
+  const __m128i n = _mm_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, n));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  for (; i < len; i++)
+    if (s[i] == c)
+      return i;
+  return len;
+}
+
+CIRCA
+size_t txtbuf_count_sse2(const char *s, size_t len, char c) {
+  const __m128i n = _mm_set1_epi8(c);
+  size_t i = 0, r = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    r += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, n)));
+  }
+  return r + txtbuf_count_scalar(s + i, len - i, c);
+}
+
+CIRCA
+void txtbuf_flip_sse2(char *s, size_t len, char lo, char hi) {
+  // Shift [lo, hi] down to the bottom of the signed range so that one signed
+  // compare answers "is this byte in range".
+  const __m128i bias = _mm_set1_epi8((char) (0x80 - (unsigned char) lo));
+  const __m128i top = _mm_set1_epi8((char) (0x80 + (unsigned char) (hi - lo) + 1));
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    __m128i in = _mm_cmplt_epi8(_mm_add_epi8(v, bias), top);
+    _mm_storeu_si128((__m128i *) (s + i), _mm_xor_si128(v, _mm_and_si128(in, bit)));
+  }
+  txtbuf_flip_scalar(s + i, len - i, lo, hi);
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+size_t txtbuf_find_avx2(const char *s, size_t len, char c) {
+  const __m256i n = _mm256_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, n));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  return i + txtbuf_find_sse2(s + i, len - i, c);
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+size_t txtbuf_count_avx2(const char *s, size_t len, char c) {
+  const __m256i n = _mm256_set1_epi8(c);
+  size_t i = 0, r = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    r += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, n)));
+  }
+  return r + txtbuf_count_sse2(s + i, len - i, c);
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+void txtbuf_flip_avx2(char *s, size_t len, char lo, char hi) {
+  const __m256i bias = _mm256_set1_epi8((char) (0x80 - (unsigned char) lo));
+  const __m256i top = _mm256_set1_epi8((char) (0x80 + (unsigned char) (hi - lo) + 1));
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i in = _mm256_cmpgt_epi8(top, _mm256_add_epi8(v, bias));
+    _mm256_storeu_si256((__m256i *) (s + i), _mm256_xor_si256(v, _mm256_and_si256(in, bit)));
+  }
+  txtbuf_flip_sse2(s + i, len - i, lo, hi);
+}
+
+#endif // CIRCA_TXTBUF_X86
+
+static const TxtBufKernels TXTBUF_KERNELS_SCALAR = {
+  "scalar", txtbuf_find_scalar, txtbuf_count_scalar, txtbuf_flip_scalar
+};
+
+#ifdef CIRCA_TXTBUF_X86
+static const TxtBufKernels TXTBUF_KERNELS_SSE2 = {
+  "sse2", txtbuf_find_sse2, txtbuf_count_sse2, txtbuf_flip_sse2
+};
+
+static const TxtBufKernels TXTBUF_KERNELS_AVX2 = {
+  "avx2", txtbuf_find_avx2, txtbuf_count_avx2, txtbuf_flip_avx2
+};
+#endif
+
+CIRCA
+const TxtBufKernels *txtbuf_kernels(void) {
+  static const TxtBufKernels *k;
+  if (k)
+    return k;
+  k = &TXTBUF_KERNELS_SCALAR;
+  #ifdef CIRCA_TXTBUF_X86
+    __builtin_cpu_init();
+    k = __builtin_cpu_supports("avx2") ? &TXTBUF_KERNELS_AVX2 : &TXTBUF_KERNELS_SSE2;
+  #endif
+  return k;
+}
+
+/* Searching */
+
+CIRCA
+CE txtbuf_find(TxtBuf *tb, size_t from, char c, size_t *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  if (from >= tb->len) {
+    *r = tb->len;
+    return CE_OK;
+  }
+  *r = from + txtbuf_kernels()->find(tb->data + from, tb->len - from, c);
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_find_cstr(TxtBuf *tb, size_t from, char *needle, size_t *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!needle, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  size_t n = strlen(needle);
+  *r = tb->len;
+  if (!n) {
+    *r = from < tb->len ? from : tb->len;
+    return CE_OK;
+  }
+  const TxtBufKernels *k = txtbuf_kernels();
+  // Scan for the first byte with the kernel and only compare the rest on a hit.
+  for (size_t i = from; (i < tb->len) && (tb->len - i >= n); i++) {
+    i += k->find(tb->data + i, tb->len - i - n + 1, needle[0]);
+    if (tb->len - i < n)
+      break;
+    if (!memcmp(tb->data + i + 1, needle + 1, n - 1)) {
+      *r = i;
+      break;
+    }
+  }
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_count(TxtBuf *tb, char c, size_t *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  *r = txtbuf_kernels()->count(tb->data, tb->len, c);
+  return CE_OK;
+}
+
+/* Splitting */
+
+CIRCA
+Slice txtbuf_token(TxtBuf *tb, char c, size_t from) {
+  const TxtBufKernels *k = txtbuf_kernels();
+  size_t l = from;
+  while ((l < tb->len) && (tb->data[l] == c))
+    l++;
+  if (l >= tb->len)
+    return (Slice) {tb->len, tb->len};
+  size_t r = l + k->find(tb->data + l, tb->len - l, c);
+  return (Slice) {l, r - 1};
+}
+
+CIRCA
+CE txtbuf_split(TxtBuf *tb, char c, Slice *out, size_t max, size_t *n) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!out, CE_NULL_ARG);
+  CE_CHECK(!n, CE_NULL_ARG);
+  size_t i = 0;
+  txtbuf_foreach_token(s, c, tb) {
+    if (i == max)
+      break;
+    out[i++] = s;
+  }
+  *n = i;
+  return CE_OK;
+}
+
+/* Transforms */
+
+CIRCA
+CE txtbuf_replace(TxtBuf *tb, char *from, char *to) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!from, CE_NULL_ARG);
+  CE_CHECK(!to, CE_NULL_ARG);
+  size_t fl = strlen(from);
+  size_t tl = strlen(to);
+  CE_CHECK(!fl, CE_ZERO_ARG);
+
+  size_t hits = 0;
+  for (size_t i = 0; txtbuf_find_cstr(tb, i, from, &i), i < tb->len; i += fl)
+    hits++;
+  if (!hits)
+    return CE_OK;
+
+  size_t len = tb->len - hits * fl + hits * tl;
+  if (tl <= fl) {
+    // Shrinking (or same size): compact forwards in place.
+    size_t w = 0, r = 0, i;
+    while (txtbuf_find_cstr(tb, r, from, &i), i < tb->len) {
+      memmove(tb->data + w, tb->data + r, i - r);
+      w += i - r;
+      memcpy(tb->data + w, to, tl);
+      w += tl;
+      r = i + fl;
+    }
+    memmove(tb->data + w, tb->data + r, tb->len - r);
+  } else {
+    // Growing: make room, then fill from the back so nothing unread is
+    // overwritten. Match positions are found front to back first.
+    CE req_fail = txtbuf_prealloc(tb, len + 1);
+    if (req_fail)
+      return req_fail;
+    size_t *at = malloc(hits * sizeof(size_t));
+    CE_CRITICAL(!at, CE_MALLOC);
+    size_t n = 0;
+    for (size_t i = 0; txtbuf_find_cstr(tb, i, from, &i), i < tb->len; i += fl)
+      at[n++] = i;
+    size_t r = tb->len, w = len;
+    while (n--) {
+      size_t tail = r - (at[n] + fl);
+      w -= tail;
+      memmove(tb->data + w, tb->data + at[n] + fl, tail);
+      w -= tl;
+      memcpy(tb->data + w, to, tl);
+      r = at[n];
+    }
+    free(at);
+  }
+  tb->len = len;
+  tb->data[len] = '\0';
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_upper(TxtBuf *tb) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  txtbuf_kernels()->flip(tb->data, tb->len, 'a', 'z');
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_lower(TxtBuf *tb) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  txtbuf_kernels()->flip(tb->data, tb->len, 'A', 'Z');
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_cat_escape(TxtBuf *dst, TxtBuf *src, char c, char *rep) {
+  CE_CHECK(!dst, CE_NULL_ARG);
+  CE_CHECK(!dst->data, CE_NULL_ARG);
+  CE_CHECK(!src, CE_NULL_ARG);
+  CE_CHECK(!src->data, CE_NULL_ARG);
+  CE_CHECK(!rep, CE_NULL_ARG);
+  const TxtBufKernels *k = txtbuf_kernels();
+  size_t rl = strlen(rep);
+  size_t hits = k->count(src->data, src->len, c);
+  CE req_fail = txtbuf_prealloc(dst, dst->len + src->len + hits * rl + 1);
+  if (req_fail)
+    return req_fail;
+  char *w = dst->data + dst->len;
+  for (size_t i = 0; i < src->len; ) {
+    size_t n = k->find(src->data + i, src->len - i, c);
+    memcpy(w, src->data + i, n);
+    w += n;
+    i += n;
+    if (i < src->len) {
+      memcpy(w, rep, rl);
+      w += rl;
+      i++;
+    }
+  }
+  dst->len = w - dst->data;
+  *w = '\0';
+  return CE_OK;
+}
+
 #endif // CIRCA_TXTBUF_H
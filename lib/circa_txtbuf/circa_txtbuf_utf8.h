@@ -0,0 +1,747 @@
+/*
+** circa_txtbuf_utf8.h | The Circa Library Set | UTF-8 text on top of TxtBuf.
+** https://github.com/davidgarland/circa_txt_buf
+*/
+
+#ifndef CIRCA_TXTBUF_UTF8_H
+#define CIRCA_TXTBUF_UTF8_H
+
+/*
+** Dependencies
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <circa_txtbuf.h>
+
+/*
+** Forward Declarations
+*/
+
+/* Code Points */
+
+CIRCA size_t txtbuf_utf8_seq(const char *s, size_t len);
+CIRCA size_t txtbuf_utf8_decode(const char *s, size_t len, uint32_t *cp);
+CIRCA size_t txtbuf_utf8_encode(char *dst, uint32_t cp);
+CIRCA size_t txtbuf_utf8_cut(const char *s, size_t len, size_t max);
+CIRCA uint32_t txtbuf_cp_upper(uint32_t cp);
+CIRCA uint32_t txtbuf_cp_lower(uint32_t cp);
+
+/* Buffers */
+
+CIRCA CE txtbuf_utf8_valid(TxtBuf *tb, bool *r);
+CIRCA CE txtbuf_utf8_count(TxtBuf *tb, size_t *r);
+CIRCA CE txtbuf_utf8_floor(TxtBuf *tb, size_t i, size_t *r);
+CIRCA CE txtbuf_utf8_next(TxtBuf *tb, size_t i, size_t *r);
+CIRCA CE txtbuf_cat_cp(TxtBuf *tb, uint32_t cp);
+CIRCA CE txtbuf_cat_latin1(TxtBuf *dst, TxtBuf *src);
+CIRCA CE txtbuf_utf8_upper(TxtBuf *tb);
+CIRCA CE txtbuf_utf8_lower(TxtBuf *tb);
+
+/*
+** Code Points
+*/
+
+CIRCA
+size_t txtbuf_utf8_seq(const char *s, size_t len) {
+  const unsigned char *u = (const unsigned char *) s;
+  if (!len)
+    return 0;
+  if (u[0] < 0x80)
+    return 1;
+  // The second byte's range depends on the lead; everything after it is a
+  // plain continuation byte.
+  size_t n;
+  unsigned char lo = 0x80, hi = 0xBF;
+  if ((u[0] >= 0xC2) && (u[0] <= 0xDF)) {
+    n = 2;
+  } else if ((u[0] >= 0xE0) && (u[0] <= 0xEF)) {
+    n = 3;
+    if (u[0] == 0xE0)
+      lo = 0xA0;
+    else if (u[0] == 0xED)
+      hi = 0x9F;
+  } else if ((u[0] >= 0xF0) && (u[0] <= 0xF4)) {
+    n = 4;
+    if (u[0] == 0xF0)
+      lo = 0x90;
+    else if (u[0] == 0xF4)
+      hi = 0x8F;
+  } else {
+    return 0;
+  }
+  if ((len < n) || (u[1] < lo) || (u[1] > hi))
+    return 0;
+  for (size_t i = 2; i < n; i++)
+    if ((u[i] & 0xC0) != 0x80)
+      return 0;
+  return n;
+}
+
+CIRCA
+size_t txtbuf_utf8_decode(const char *s, size_t len, uint32_t *cp) {
+  const unsigned char *u = (const unsigned char *) s;
+  size_t n = txtbuf_utf8_seq(s, len);
+  switch (n) {
+    case 1: *cp = u[0]; break;
+    case 2: *cp = ((u[0] & 0x1F) << 6) | (u[1] & 0x3F); break;
+    case 3: *cp = ((u[0] & 0x0F) << 12) | ((u[1] & 0x3F) << 6) | (u[2] & 0x3F); break;
+    case 4: *cp = ((uint32_t) (u[0] & 0x07) << 18) | ((u[1] & 0x3F) << 12) | ((u[2] & 0x3F) << 6) | (u[3] & 0x3F); break;
+  }
+  return n;
+}
+
+CIRCA
+size_t txtbuf_utf8_encode(char *dst, uint32_t cp) {
+  unsigned char *u = (unsigned char *) dst;
+  if (cp < 0x80) {
+    u[0] = cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    u[0] = 0xC0 | (cp >> 6);
+    u[1] = 0x80 | (cp & 0x3F);
+    return 2;
+  }
+  if ((cp >= 0xD800) && (cp <= 0xDFFF))
+    cp = 0xFFFD;
+  if (cp < 0x10000) {
+    u[0] = 0xE0 | (cp >> 12);
+    u[1] = 0x80 | ((cp >> 6) & 0x3F);
+    u[2] = 0x80 | (cp & 0x3F);
+    return 3;
+  }
+  if (cp > 0x10FFFF)
+    return txtbuf_utf8_encode(dst, 0xFFFD);
+  u[0] = 0xF0 | (cp >> 18);
+  u[1] = 0x80 | ((cp >> 12) & 0x3F);
+  u[2] = 0x80 | ((cp >> 6) & 0x3F);
+  u[3] = 0x80 | (cp & 0x3F);
+  return 4;
+}
+
+CIRCA
+size_t txtbuf_utf8_cut(const char *s, size_t len, size_t max) {
+  if (len <= max)
+    return len;
+  size_t n = max;
+  while (n && (max - n < 3) && ((s[n] & 0xC0) == 0x80))
+    n--;
+  return ((s[n] & 0xC0) == 0x80) || !n ? max : n;
+}
+
+/*
+** Simple case mapping. Each range maps n code points, stride apart starting at
+** lo, by adding delta. The tables hold the one-to-one mappings from the
+** Unicode 14.0 character database for everything outside ASCII; ranges never
+** overlap, which the binary search relies on.
+*/
+
+typedef struct {
+  uint32_t lo;
+  uint16_t n;
+  uint8_t stride;
+  int32_t delta;
+} TxtBufCaseRange;
+
+static const TxtBufCaseRange TXTBUF_UTF8_UPPER[] = {
+  {0x00B5, 1, 1, 743}, {0x00E0, 23, 1, -32}, {0x00F8, 7, 1, -32},
+  {0x00FF, 1, 1, 121}, {0x0101, 24, 2, -1}, {0x0131, 1, 1, -232},
+  {0x0133, 3, 2, -1}, {0x013A, 8, 2, -1}, {0x014B, 23, 2, -1},
+  {0x017A, 3, 2, -1}, {0x017F, 1, 1, -300}, {0x0180, 1, 1, 195},
+  {0x0183, 2, 2, -1}, {0x0188, 1, 1, -1}, {0x018C, 1, 1, -1},
+  {0x0192, 1, 1, -1}, {0x0195, 1, 1, 97}, {0x0199, 1, 1, -1},
+  {0x019A, 1, 1, 163}, {0x019E, 1, 1, 130}, {0x01A1, 3, 2, -1},
+  {0x01A8, 1, 1, -1}, {0x01AD, 1, 1, -1}, {0x01B0, 1, 1, -1},
+  {0x01B4, 2, 2, -1}, {0x01B9, 1, 1, -1}, {0x01BD, 1, 1, -1},
+  {0x01BF, 1, 1, 56}, {0x01C5, 1, 1, -1}, {0x01C6, 1, 1, -2},
+  {0x01C8, 1, 1, -1}, {0x01C9, 1, 1, -2}, {0x01CB, 1, 1, -1},
+  {0x01CC, 1, 1, -2}, {0x01CE, 8, 2, -1}, {0x01DD, 1, 1, -79},
+  {0x01DF, 9, 2, -1}, {0x01F2, 1, 1, -1}, {0x01F3, 1, 1, -2},
+  {0x01F5, 1, 1, -1}, {0x01F9, 20, 2, -1}, {0x0223, 9, 2, -1},
+  {0x023C, 1, 1, -1}, {0x023F, 2, 1, 10815}, {0x0242, 1, 1, -1},
+  {0x0247, 5, 2, -1}, {0x0250, 1, 1, 10783}, {0x0251, 1, 1, 10780},
+  {0x0252, 1, 1, 10782}, {0x0253, 1, 1, -210}, {0x0254, 1, 1, -206},
+  {0x0256, 2, 1, -205}, {0x0259, 1, 1, -202}, {0x025B, 1, 1, -203},
+  {0x025C, 1, 1, 42319}, {0x0260, 1, 1, -205}, {0x0261, 1, 1, 42315},
+  {0x0263, 1, 1, -207}, {0x0265, 1, 1, 42280}, {0x0266, 1, 1, 42308},
+  {0x0268, 1, 1, -209}, {0x0269, 1, 1, -211}, {0x026A, 1, 1, 42308},
+  {0x026B, 1, 1, 10743}, {0x026C, 1, 1, 42305}, {0x026F, 1, 1, -211},
+  {0x0271, 1, 1, 10749}, {0x0272, 1, 1, -213}, {0x0275, 1, 1, -214},
+  {0x027D, 1, 1, 10727}, {0x0280, 1, 1, -218}, {0x0282, 1, 1, 42307},
+  {0x0283, 1, 1, -218}, {0x0287, 1, 1, 42282}, {0x0288, 1, 1, -218},
+  {0x0289, 1, 1, -69}, {0x028A, 2, 1, -217}, {0x028C, 1, 1, -71},
+  {0x0292, 1, 1, -219}, {0x029D, 1, 1, 42261}, {0x029E, 1, 1, 42258},
+  {0x0345, 1, 1, 84}, {0x0371, 2, 2, -1}, {0x0377, 1, 1, -1},
+  {0x037B, 3, 1, 130}, {0x03AC, 1, 1, -38}, {0x03AD, 3, 1, -37},
+  {0x03B1, 17, 1, -32}, {0x03C2, 1, 1, -31}, {0x03C3, 9, 1, -32},
+  {0x03CC, 1, 1, -64}, {0x03CD, 2, 1, -63}, {0x03D0, 1, 1, -62},
+  {0x03D1, 1, 1, -57}, {0x03D5, 1, 1, -47}, {0x03D6, 1, 1, -54},
+  {0x03D7, 1, 1, -8}, {0x03D9, 12, 2, -1}, {0x03F0, 1, 1, -86},
+  {0x03F1, 1, 1, -80}, {0x03F2, 1, 1, 7}, {0x03F3, 1, 1, -116},
+  {0x03F5, 1, 1, -96}, {0x03F8, 1, 1, -1}, {0x03FB, 1, 1, -1},
+  {0x0430, 32, 1, -32}, {0x0450, 16, 1, -80}, {0x0461, 17, 2, -1},
+  {0x048B, 27, 2, -1}, {0x04C2, 7, 2, -1}, {0x04CF, 1, 1, -15},
+  {0x04D1, 48, 2, -1}, {0x0561, 38, 1, -48}, {0x10D0, 43, 1, 3008},
+  {0x10FD, 3, 1, 3008}, {0x13F8, 6, 1, -8}, {0x1C80, 1, 1, -6254},
+  {0x1C81, 1, 1, -6253}, {0x1C82, 1, 1, -6244}, {0x1C83, 2, 1, -6242},
+  {0x1C85, 1, 1, -6243}, {0x1C86, 1, 1, -6236}, {0x1C87, 1, 1, -6181},
+  {0x1C88, 1, 1, 35266}, {0x1D79, 1, 1, 35332}, {0x1D7D, 1, 1, 3814},
+  {0x1D8E, 1, 1, 35384}, {0x1E01, 75, 2, -1}, {0x1E9B, 1, 1, -59},
+  {0x1EA1, 48, 2, -1}, {0x1F00, 8, 1, 8}, {0x1F10, 6, 1, 8}, {0x1F20, 8, 1, 8},
+  {0x1F30, 8, 1, 8}, {0x1F40, 6, 1, 8}, {0x1F51, 4, 2, 8}, {0x1F60, 8, 1, 8},
+  {0x1F70, 2, 1, 74}, {0x1F72, 4, 1, 86}, {0x1F76, 2, 1, 100},
+  {0x1F78, 2, 1, 128}, {0x1F7A, 2, 1, 112}, {0x1F7C, 2, 1, 126},
+  {0x1F80, 8, 1, 8}, {0x1F90, 8, 1, 8}, {0x1FA0, 8, 1, 8}, {0x1FB0, 2, 1, 8},
+  {0x1FB3, 1, 1, 9}, {0x1FBE, 1, 1, -7205}, {0x1FC3, 1, 1, 9},
+  {0x1FD0, 2, 1, 8}, {0x1FE0, 2, 1, 8}, {0x1FE5, 1, 1, 7}, {0x1FF3, 1, 1, 9},
+  {0x214E, 1, 1, -28}, {0x2170, 16, 1, -16}, {0x2184, 1, 1, -1},
+  {0x24D0, 26, 1, -26}, {0x2C30, 48, 1, -48}, {0x2C61, 1, 1, -1},
+  {0x2C65, 1, 1, -10795}, {0x2C66, 1, 1, -10792}, {0x2C68, 3, 2, -1},
+  {0x2C73, 1, 1, -1}, {0x2C76, 1, 1, -1}, {0x2C81, 50, 2, -1},
+  {0x2CEC, 2, 2, -1}, {0x2CF3, 1, 1, -1}, {0x2D00, 38, 1, -7264},
+  {0x2D27, 1, 1, -7264}, {0x2D2D, 1, 1, -7264}, {0xA641, 23, 2, -1},
+  {0xA681, 14, 2, -1}, {0xA723, 7, 2, -1}, {0xA733, 31, 2, -1},
+  {0xA77A, 2, 2, -1}, {0xA77F, 5, 2, -1}, {0xA78C, 1, 1, -1},
+  {0xA791, 2, 2, -1}, {0xA794, 1, 1, 48}, {0xA797, 10, 2, -1},
+  {0xA7B5, 8, 2, -1}, {0xA7C8, 2, 2, -1}, {0xA7D1, 1, 1, -1},
+  {0xA7D7, 2, 2, -1}, {0xA7F6, 1, 1, -1}, {0xAB53, 1, 1, -928},
+  {0xAB70, 80, 1, -38864}, {0xFF41, 26, 1, -32}, {0x10428, 40, 1, -40},
+  {0x104D8, 36, 1, -40}, {0x10597, 11, 1, -39}, {0x105A3, 15, 1, -39},
+  {0x105B3, 7, 1, -39}, {0x105BB, 2, 1, -39}, {0x10CC0, 51, 1, -64},
+  {0x118C0, 32, 1, -32}, {0x16E60, 32, 1, -32}, {0x1E922, 34, 1, -34},
+};
+
+static const TxtBufCaseRange TXTBUF_UTF8_LOWER[] = {
+  {0x00C0, 23, 1, 32}, {0x00D8, 7, 1, 32}, {0x0100, 24, 2, 1},
+  {0x0130, 1, 1, -199}, {0x0132, 3, 2, 1}, {0x0139, 8, 2, 1},
+  {0x014A, 23, 2, 1}, {0x0178, 1, 1, -121}, {0x0179, 3, 2, 1},
+  {0x0181, 1, 1, 210}, {0x0182, 2, 2, 1}, {0x0186, 1, 1, 206},
+  {0x0187, 1, 1, 1}, {0x0189, 2, 1, 205}, {0x018B, 1, 1, 1}, {0x018E, 1, 1, 79},
+  {0x018F, 1, 1, 202}, {0x0190, 1, 1, 203}, {0x0191, 1, 1, 1},
+  {0x0193, 1, 1, 205}, {0x0194, 1, 1, 207}, {0x0196, 1, 1, 211},
+  {0x0197, 1, 1, 209}, {0x0198, 1, 1, 1}, {0x019C, 1, 1, 211},
+  {0x019D, 1, 1, 213}, {0x019F, 1, 1, 214}, {0x01A0, 3, 2, 1},
+  {0x01A6, 1, 1, 218}, {0x01A7, 1, 1, 1}, {0x01A9, 1, 1, 218},
+  {0x01AC, 1, 1, 1}, {0x01AE, 1, 1, 218}, {0x01AF, 1, 1, 1},
+  {0x01B1, 2, 1, 217}, {0x01B3, 2, 2, 1}, {0x01B7, 1, 1, 219},
+  {0x01B8, 1, 1, 1}, {0x01BC, 1, 1, 1}, {0x01C4, 1, 1, 2}, {0x01C5, 1, 1, 1},
+  {0x01C7, 1, 1, 2}, {0x01C8, 1, 1, 1}, {0x01CA, 1, 1, 2}, {0x01CB, 9, 2, 1},
+  {0x01DE, 9, 2, 1}, {0x01F1, 1, 1, 2}, {0x01F2, 2, 2, 1}, {0x01F6, 1, 1, -97},
+  {0x01F7, 1, 1, -56}, {0x01F8, 20, 2, 1}, {0x0220, 1, 1, -130},
+  {0x0222, 9, 2, 1}, {0x023A, 1, 1, 10795}, {0x023B, 1, 1, 1},
+  {0x023D, 1, 1, -163}, {0x023E, 1, 1, 10792}, {0x0241, 1, 1, 1},
+  {0x0243, 1, 1, -195}, {0x0244, 1, 1, 69}, {0x0245, 1, 1, 71},
+  {0x0246, 5, 2, 1}, {0x0370, 2, 2, 1}, {0x0376, 1, 1, 1}, {0x037F, 1, 1, 116},
+  {0x0386, 1, 1, 38}, {0x0388, 3, 1, 37}, {0x038C, 1, 1, 64},
+  {0x038E, 2, 1, 63}, {0x0391, 17, 1, 32}, {0x03A3, 9, 1, 32},
+  {0x03CF, 1, 1, 8}, {0x03D8, 12, 2, 1}, {0x03F4, 1, 1, -60}, {0x03F7, 1, 1, 1},
+  {0x03F9, 1, 1, -7}, {0x03FA, 1, 1, 1}, {0x03FD, 3, 1, -130},
+  {0x0400, 16, 1, 80}, {0x0410, 32, 1, 32}, {0x0460, 17, 2, 1},
+  {0x048A, 27, 2, 1}, {0x04C0, 1, 1, 15}, {0x04C1, 7, 2, 1}, {0x04D0, 48, 2, 1},
+  {0x0531, 38, 1, 48}, {0x10A0, 38, 1, 7264}, {0x10C7, 1, 1, 7264},
+  {0x10CD, 1, 1, 7264}, {0x13A0, 80, 1, 38864}, {0x13F0, 6, 1, 8},
+  {0x1C90, 43, 1, -3008}, {0x1CBD, 3, 1, -3008}, {0x1E00, 75, 2, 1},
+  {0x1E9E, 1, 1, -7615}, {0x1EA0, 48, 2, 1}, {0x1F08, 8, 1, -8},
+  {0x1F18, 6, 1, -8}, {0x1F28, 8, 1, -8}, {0x1F38, 8, 1, -8},
+  {0x1F48, 6, 1, -8}, {0x1F59, 4, 2, -8}, {0x1F68, 8, 1, -8},
+  {0x1F88, 8, 1, -8}, {0x1F98, 8, 1, -8}, {0x1FA8, 8, 1, -8},
+  {0x1FB8, 2, 1, -8}, {0x1FBA, 2, 1, -74}, {0x1FBC, 1, 1, -9},
+  {0x1FC8, 4, 1, -86}, {0x1FCC, 1, 1, -9}, {0x1FD8, 2, 1, -8},
+  {0x1FDA, 2, 1, -100}, {0x1FE8, 2, 1, -8}, {0x1FEA, 2, 1, -112},
+  {0x1FEC, 1, 1, -7}, {0x1FF8, 2, 1, -128}, {0x1FFA, 2, 1, -126},
+  {0x1FFC, 1, 1, -9}, {0x2126, 1, 1, -7517}, {0x212A, 1, 1, -8383},
+  {0x212B, 1, 1, -8262}, {0x2132, 1, 1, 28}, {0x2160, 16, 1, 16},
+  {0x2183, 1, 1, 1}, {0x24B6, 26, 1, 26}, {0x2C00, 48, 1, 48},
+  {0x2C60, 1, 1, 1}, {0x2C62, 1, 1, -10743}, {0x2C63, 1, 1, -3814},
+  {0x2C64, 1, 1, -10727}, {0x2C67, 3, 2, 1}, {0x2C6D, 1, 1, -10780},
+  {0x2C6E, 1, 1, -10749}, {0x2C6F, 1, 1, -10783}, {0x2C70, 1, 1, -10782},
+  {0x2C72, 1, 1, 1}, {0x2C75, 1, 1, 1}, {0x2C7E, 2, 1, -10815},
+  {0x2C80, 50, 2, 1}, {0x2CEB, 2, 2, 1}, {0x2CF2, 1, 1, 1}, {0xA640, 23, 2, 1},
+  {0xA680, 14, 2, 1}, {0xA722, 7, 2, 1}, {0xA732, 31, 2, 1}, {0xA779, 2, 2, 1},
+  {0xA77D, 1, 1, -35332}, {0xA77E, 5, 2, 1}, {0xA78B, 1, 1, 1},
+  {0xA78D, 1, 1, -42280}, {0xA790, 2, 2, 1}, {0xA796, 10, 2, 1},
+  {0xA7AA, 1, 1, -42308}, {0xA7AB, 1, 1, -42319}, {0xA7AC, 1, 1, -42315},
+  {0xA7AD, 1, 1, -42305}, {0xA7AE, 1, 1, -42308}, {0xA7B0, 1, 1, -42258},
+  {0xA7B1, 1, 1, -42282}, {0xA7B2, 1, 1, -42261}, {0xA7B3, 1, 1, 928},
+  {0xA7B4, 8, 2, 1}, {0xA7C4, 1, 1, -48}, {0xA7C5, 1, 1, -42307},
+  {0xA7C6, 1, 1, -35384}, {0xA7C7, 2, 2, 1}, {0xA7D0, 1, 1, 1},
+  {0xA7D6, 2, 2, 1}, {0xA7F5, 1, 1, 1}, {0xFF21, 26, 1, 32},
+  {0x10400, 40, 1, 40}, {0x104B0, 36, 1, 40}, {0x10570, 11, 1, 39},
+  {0x1057C, 15, 1, 39}, {0x1058C, 7, 1, 39}, {0x10594, 2, 1, 39},
+  {0x10C80, 51, 1, 64}, {0x118A0, 32, 1, 32}, {0x16E40, 32, 1, 32},
+  {0x1E900, 34, 1, 34},
+};
+
+CIRCA
+uint32_t txtbuf_cp_map(const TxtBufCaseRange *t, size_t n, uint32_t cp) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t m = lo + (hi - lo) / 2;
+    if (t[m].lo <= cp)
+      lo = m + 1;
+    else
+      hi = m;
+  }
+  if (!lo)
+    return cp;
+  const TxtBufCaseRange *r = &t[lo - 1];
+  uint32_t off = cp - r->lo;
+  if ((off % r->stride) || (off / r->stride >= r->n))
+    return cp;
+  return cp + r->delta;
+}
+
+CIRCA
+uint32_t txtbuf_cp_upper(uint32_t cp) {
+  if (cp < 0x80)
+    return (cp >= 'a') && (cp <= 'z') ? cp ^ 0x20 : cp;
+  return txtbuf_cp_map(TXTBUF_UTF8_UPPER, sizeof(TXTBUF_UTF8_UPPER) / sizeof(TxtBufCaseRange), cp);
+}
+
+CIRCA
+uint32_t txtbuf_cp_lower(uint32_t cp) {
+  if (cp < 0x80)
+    return (cp >= 'A') && (cp <= 'Z') ? cp ^ 0x20 : cp;
+  return txtbuf_cp_map(TXTBUF_UTF8_LOWER, sizeof(TXTBUF_UTF8_LOWER) / sizeof(TxtBufCaseRange), cp);
+}
+
+/*
+** Kernels. These follow the same scheme as the ones in circa_txtbuf.h: one
+** set is picked per CPU the first time any of them runs.
+*/
+
+typedef struct {
+  const char *name;
+  size_t (*ascii)(const char *s, size_t len);
+  size_t (*count)(const char *s, size_t len);
+  bool (*valid)(const char *s, size_t len);
+} TxtBufUtf8Kernels;
+
+CIRCA
+size_t txtbuf_utf8_ascii_scalar(const char *s, size_t len) {
+  size_t i = 0;
+  while ((i < len) && !(s[i] & 0x80))
+    i++;
+  return i;
+}
+
+CIRCA
+size_t txtbuf_utf8_count_scalar(const char *s, size_t len) {
+  size_t r = 0;
+  for (size_t i = 0; i < len; i++)
+    r += (s[i] & 0xC0) != 0x80;
+  return r;
+}
+
+CIRCA
+bool txtbuf_utf8_valid_scalar(const char *s, size_t len) {
+  for (size_t i = 0; i < len; ) {
+    size_t n = txtbuf_utf8_seq(s + i, len - i);
+    if (!n)
+      return false;
+    i += n;
+  }
+  return true;
+}
+
+#ifdef CIRCA_TXTBUF_X86
+
+CIRCA
+size_t txtbuf_utf8_ascii_sse2(const char *s, size_t len) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    unsigned m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (s + i)));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  return i + txtbuf_utf8_ascii_scalar(s + i, len - i);
+}
+
+CIRCA
+size_t txtbuf_utf8_count_sse2(const char *s, size_t len) {
+  // Continuation bytes are 0x80-0xBF, which are exactly the signed bytes
+  // below -64; everything else starts a code point.
+  const __m128i cont = _mm_set1_epi8(-65);
+  size_t i = 0, r = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    r += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, cont)));
+  }
+  return r + txtbuf_utf8_count_scalar(s + i, len - i);
+}
+
+// SSE2 has no byte shuffle to drive the lookup tables below, so it only skips
+// ASCII in bulk and checks each multibyte sequence it lands on by hand.
+CIRCA
+bool txtbuf_utf8_valid_sse2(const char *s, size_t len) {
+  for (size_t i = 0; i < len; ) {
+    i += txtbuf_utf8_ascii_sse2(s + i, len - i);
+    if (i == len)
+      break;
+    size_t n = txtbuf_utf8_seq(s + i, len - i);
+    if (!n)
+      return false;
+    i += n;
+  }
+  return true;
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+size_t txtbuf_utf8_ascii_avx2(const char *s, size_t len) {
+  // Text is usually all ASCII, so test four vectors at once and only look
+  // closer when one of them has a high bit set.
+  size_t i = 0;
+  for (; i + 128 <= len; i += 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (s + i + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i *) (s + i + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i *) (s + i + 96));
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d))))
+      break;
+  }
+  for (; i + 32 <= len; i += 32) {
+    unsigned m = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (s + i)));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  return i + txtbuf_utf8_ascii_sse2(s + i, len - i);
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+size_t txtbuf_utf8_count_avx2(const char *s, size_t len) {
+  const __m256i cont = _mm256_set1_epi8(-65);
+  size_t i = 0, r = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    r += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, cont)));
+  }
+  return r + txtbuf_utf8_count_sse2(s + i, len - i);
+}
+
+/*
+** The AVX2 validator is the lookup algorithm from Keiser and Lemire,
+** "Validating UTF-8 In Less Than One Instruction Per Byte". Every byte is
+** classified by three 16-entry tables: the high and low nibbles of the byte
+** before it and its own high nibble. Each table entry is a set of error bits,
+** and a real error shows up in all three. Sequences of three and four bytes
+** are then checked separately by looking two and three bytes back.
+*/
+
+#define TXTBUF_UTF8_TOO_SHORT (1 << 0)
+#define TXTBUF_UTF8_TOO_LONG (1 << 1)
+#define TXTBUF_UTF8_OVERLONG_3 (1 << 2)
+#define TXTBUF_UTF8_TOO_LARGE (1 << 3)
+#define TXTBUF_UTF8_SURROGATE (1 << 4)
+#define TXTBUF_UTF8_OVERLONG_2 (1 << 5)
+#define TXTBUF_UTF8_TOO_LARGE_1000 (1 << 6)
+#define TXTBUF_UTF8_OVERLONG_4 (1 << 6)
+#define TXTBUF_UTF8_TWO_CONTS (1 << 7)
+#define TXTBUF_UTF8_CARRY (TXTBUF_UTF8_TOO_SHORT | TXTBUF_UTF8_TOO_LONG | TXTBUF_UTF8_TWO_CONTS)
+
+CIRCA CIRCA_ATTR(target("avx2"))
+__m256i txtbuf_utf8_prev_avx2(__m256i v, __m256i prev, int n) {
+  // Shifts v right by n bytes across the lane boundary, pulling in the last
+  // bytes of prev.
+  __m256i t = _mm256_permute2x128_si256(prev, v, 0x21);
+  switch (n) {
+    case 1: return _mm256_alignr_epi8(v, t, 15);
+    case 2: return _mm256_alignr_epi8(v, t, 14);
+    default: return _mm256_alignr_epi8(v, t, 13);
+  }
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+__m256i txtbuf_utf8_block_avx2(__m256i v, __m256i prev) {
+  #define B(X) ((char) (X))
+  #define T(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+  const __m256i nib = _mm256_set1_epi8(0x0F);
+  const __m256i byte_1_high_tab = T(
+    B(TXTBUF_UTF8_TOO_LONG), B(TXTBUF_UTF8_TOO_LONG), B(TXTBUF_UTF8_TOO_LONG), B(TXTBUF_UTF8_TOO_LONG),
+    B(TXTBUF_UTF8_TOO_LONG), B(TXTBUF_UTF8_TOO_LONG), B(TXTBUF_UTF8_TOO_LONG), B(TXTBUF_UTF8_TOO_LONG),
+    B(TXTBUF_UTF8_TWO_CONTS), B(TXTBUF_UTF8_TWO_CONTS), B(TXTBUF_UTF8_TWO_CONTS), B(TXTBUF_UTF8_TWO_CONTS),
+    B(TXTBUF_UTF8_TOO_SHORT | TXTBUF_UTF8_OVERLONG_2),
+    B(TXTBUF_UTF8_TOO_SHORT),
+    B(TXTBUF_UTF8_TOO_SHORT | TXTBUF_UTF8_OVERLONG_3 | TXTBUF_UTF8_SURROGATE),
+    B(TXTBUF_UTF8_TOO_SHORT | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000 | TXTBUF_UTF8_OVERLONG_4)
+  );
+  const __m256i byte_1_low_tab = T(
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_OVERLONG_3 | TXTBUF_UTF8_OVERLONG_2 | TXTBUF_UTF8_OVERLONG_4),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_OVERLONG_2),
+    B(TXTBUF_UTF8_CARRY),
+    B(TXTBUF_UTF8_CARRY),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000 | TXTBUF_UTF8_SURROGATE),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000),
+    B(TXTBUF_UTF8_CARRY | TXTBUF_UTF8_TOO_LARGE | TXTBUF_UTF8_TOO_LARGE_1000)
+  );
+  const __m256i byte_2_high_tab = T(
+    B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT),
+    B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT),
+    B(TXTBUF_UTF8_TOO_LONG | TXTBUF_UTF8_OVERLONG_2 | TXTBUF_UTF8_TWO_CONTS | TXTBUF_UTF8_OVERLONG_3 | TXTBUF_UTF8_TOO_LARGE_1000 | TXTBUF_UTF8_OVERLONG_4),
+    B(TXTBUF_UTF8_TOO_LONG | TXTBUF_UTF8_OVERLONG_2 | TXTBUF_UTF8_TWO_CONTS | TXTBUF_UTF8_OVERLONG_3 | TXTBUF_UTF8_TOO_LARGE),
+    B(TXTBUF_UTF8_TOO_LONG | TXTBUF_UTF8_OVERLONG_2 | TXTBUF_UTF8_TWO_CONTS | TXTBUF_UTF8_SURROGATE | TXTBUF_UTF8_TOO_LARGE),
+    B(TXTBUF_UTF8_TOO_LONG | TXTBUF_UTF8_OVERLONG_2 | TXTBUF_UTF8_TWO_CONTS | TXTBUF_UTF8_SURROGATE | TXTBUF_UTF8_TOO_LARGE),
+    B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT), B(TXTBUF_UTF8_TOO_SHORT)
+  );
+  #undef T
+  #undef B
+
+  __m256i prev1 = txtbuf_utf8_prev_avx2(v, prev, 1);
+  __m256i b1h = _mm256_shuffle_epi8(byte_1_high_tab, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib));
+  __m256i b1l = _mm256_shuffle_epi8(byte_1_low_tab, _mm256_and_si256(prev1, nib));
+  __m256i b2h = _mm256_shuffle_epi8(byte_2_high_tab, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+  __m256i sc = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+  // Bytes two or three after a 3- or 4-byte lead have to be continuations;
+  // TWO_CONTS above marks every continuation after a continuation, and the
+  // two sets have to agree.
+  __m256i prev2 = txtbuf_utf8_prev_avx2(v, prev, 2);
+  __m256i prev3 = txtbuf_utf8_prev_avx2(v, prev, 3);
+  __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0 - 0x80)));
+  __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0 - 0x80)));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char) 0x80));
+  return _mm256_xor_si256(must23, sc);
+}
+
+CIRCA CIRCA_ATTR(target("avx2"))
+bool txtbuf_utf8_valid_avx2(const char *s, size_t len) {
+  // A block ending partway through a sequence is only an error if the next
+  // block doesn't finish it, which its own check covers; the last block is
+  // padded with zeroes so that a truncated sequence at the very end fails.
+  __m256i err = _mm256_setzero_si256();
+  __m256i prev = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *) (s + i));
+    __m256i v1 = _mm256_loadu_si256((const __m256i *) (s + i + 32));
+    if (!_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(v0, v1), prev))) {
+      prev = v1;
+      continue;
+    }
+    err = _mm256_or_si256(err, txtbuf_utf8_block_avx2(v0, prev));
+    err = _mm256_or_si256(err, txtbuf_utf8_block_avx2(v1, v0));
+    prev = v1;
+  }
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    if (_mm256_movemask_epi8(v) || _mm256_movemask_epi8(prev))
+      err = _mm256_or_si256(err, txtbuf_utf8_block_avx2(v, prev));
+    prev = v;
+  }
+  char tail[64] = {0};
+  memcpy(tail, s + i, len - i);
+  for (size_t j = 0; j < 64; j += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (tail + j));
+    err = _mm256_or_si256(err, txtbuf_utf8_block_avx2(v, prev));
+    prev = v;
+  }
+  return _mm256_testz_si256(err, err);
+}
+
+#endif // CIRCA_TXTBUF_X86
+
+static const TxtBufUtf8Kernels TXTBUF_UTF8_KERNELS_SCALAR = {
+  "scalar", txtbuf_utf8_ascii_scalar, txtbuf_utf8_count_scalar, txtbuf_utf8_valid_scalar
+};
+
+#ifdef CIRCA_TXTBUF_X86
+static const TxtBufUtf8Kernels TXTBUF_UTF8_KERNELS_SSE2 = {
+  "sse2", txtbuf_utf8_ascii_sse2, txtbuf_utf8_count_sse2, txtbuf_utf8_valid_sse2
+};
+
+static const TxtBufUtf8Kernels TXTBUF_UTF8_KERNELS_AVX2 = {
+  "avx2", txtbuf_utf8_ascii_avx2, txtbuf_utf8_count_avx2, txtbuf_utf8_valid_avx2
+};
+#endif
+
+CIRCA
+const TxtBufUtf8Kernels *txtbuf_utf8_kernels(void) {
+  static const TxtBufUtf8Kernels *k;
+  if (k)
+    return k;
+  k = &TXTBUF_UTF8_KERNELS_SCALAR;
+  #ifdef CIRCA_TXTBUF_X86
+    __builtin_cpu_init();
+    k = __builtin_cpu_supports("avx2") ? &TXTBUF_UTF8_KERNELS_AVX2 : &TXTBUF_UTF8_KERNELS_SSE2;
+  #endif
+  return k;
+}
+
+/*
+** Buffers
+*/
+
+CIRCA
+CE txtbuf_utf8_valid(TxtBuf *tb, bool *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  *r = txtbuf_utf8_kernels()->valid(tb->data, tb->len);
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_utf8_count(TxtBuf *tb, size_t *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  *r = txtbuf_utf8_kernels()->count(tb->data, tb->len);
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_utf8_floor(TxtBuf *tb, size_t i, size_t *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  if (i >= tb->len) {
+    *r = tb->len;
+    return CE_OK;
+  }
+  size_t n = i;
+  while (n && (i - n < 3) && ((tb->data[n] & 0xC0) == 0x80))
+    n--;
+  // Stray continuation bytes count as characters of their own.
+  *r = txtbuf_utf8_seq(tb->data + n, tb->len - n) > i - n ? n : i;
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_utf8_next(TxtBuf *tb, size_t i, size_t *r) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE_CHECK(!r, CE_NULL_ARG);
+  if (i >= tb->len) {
+    *r = tb->len;
+    return CE_OK;
+  }
+  size_t f;
+  txtbuf_utf8_floor(tb, i, &f);
+  size_t n = txtbuf_utf8_seq(tb->data + f, tb->len - f);
+  *r = f + (n ? n : 1);
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_cat_cp(TxtBuf *tb, uint32_t cp) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  CE req_fail = txtbuf_prealloc(tb, tb->len + 5);
+  if (req_fail)
+    return req_fail;
+  tb->len += txtbuf_utf8_encode(tb->data + tb->len, cp);
+  tb->data[tb->len] = '\0';
+  return CE_OK;
+}
+
+CIRCA
+CE txtbuf_cat_latin1(TxtBuf *dst, TxtBuf *src) {
+  CE_CHECK(!dst, CE_NULL_ARG);
+  CE_CHECK(!dst->data, CE_NULL_ARG);
+  CE_CHECK(!src, CE_NULL_ARG);
+  CE_CHECK(!src->data, CE_NULL_ARG);
+  const TxtBufUtf8Kernels *k = txtbuf_utf8_kernels();
+  CE req_fail = txtbuf_prealloc(dst, dst->len + src->len * 2 + 1);
+  if (req_fail)
+    return req_fail;
+  char *w = dst->data + dst->len;
+  for (size_t i = 0; i < src->len; ) {
+    size_t n = k->ascii(src->data + i, src->len - i);
+    memcpy(w, src->data + i, n);
+    w += n;
+    i += n;
+    if (i < src->len)
+      w += txtbuf_utf8_encode(w, (unsigned char) src->data[i++]);
+  }
+  dst->len = w - dst->data;
+  *w = '\0';
+  return CE_OK;
+}
+
+// The txtbuf case kernel only ever touches ASCII letters, so it runs over the
+// whole buffer first; after that only the code points outside ASCII are
+// decoded and looked up. Almost every mapping keeps its encoded length and is
+// written back in place. The first one that doesn't moves the rest of the work
+// to a scratch copy, since a mapping can be up to half again as long as what
+// it replaces.
+CIRCA
+CE txtbuf_utf8_case(TxtBuf *tb, bool upper) {
+  CE_CHECK(!tb, CE_NULL_ARG);
+  CE_CHECK(!tb->data, CE_NULL_ARG);
+  const TxtBufUtf8Kernels *k = txtbuf_utf8_kernels();
+  if (upper)
+    txtbuf_kernels()->flip(tb->data, tb->len, 'a', 'z');
+  else
+    txtbuf_kernels()->flip(tb->data, tb->len, 'A', 'Z');
+
+  char enc[4];
+  size_t i = 0, n;
+  while (true) {
+    i += k->ascii(tb->data + i, tb->len - i);
+    if (i == tb->len)
+      return CE_OK;
+    uint32_t cp;
+    n = txtbuf_utf8_decode(tb->data + i, tb->len - i, &cp);
+    if (!n) {
+      i++;
+      continue;
+    }
+    size_t m = txtbuf_utf8_encode(enc, upper ? txtbuf_cp_upper(cp) : txtbuf_cp_lower(cp));
+    if (m != n)
+      break;
+    memcpy(tb->data + i, enc, m);
+    i += n;
+  }
+
+  size_t head = i;
+  size_t rest = tb->len - head;
+  char *tmp = malloc(rest + rest / 2 + 4);
+  CE_CRITICAL(!tmp, CE_MALLOC);
+  char *w = tmp;
+  while (i < tb->len) {
+    uint32_t cp;
+    n = txtbuf_utf8_decode(tb->data + i, tb->len - i, &cp);
+    if (!n) {
+      *w++ = tb->data[i++];
+    } else {
+      w += txtbuf_utf8_encode(w, upper ? txtbuf_cp_upper(cp) : txtbuf_cp_lower(cp));
+      i += n;
+    }
+    n = k->ascii(tb->data + i, tb->len - i);
+    memcpy(w, tb->data + i, n);
+    w += n;
+    i += n;
+  }
+
+  size_t len = head + (w - tmp);
+  CE req_fail = txtbuf_prealloc(tb, len + 1);
+  if (!req_fail) {
+    memcpy(tb->data + head, tmp, w - tmp);
+    tb->len = len;
+    tb->data[len] = '\0';
+  }
+  free(tmp);
+  return req_fail;
+}
+
+CIRCA
+CE txtbuf_utf8_upper(TxtBuf *tb) {
+  return txtbuf_utf8_case(tb, true);
+}
+
+CIRCA
+CE txtbuf_utf8_lower(TxtBuf *tb) {
+  return txtbuf_utf8_case(tb, false);
+}
+
+#endif // CIRCA_TXTBUF_UTF8_H
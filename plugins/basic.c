@@ -0,0 +1,102 @@
+/*
+** basic.c | Digi's IRC Bot | Native versions of the backend's simple commands.
+** https://github.com/davidgarland/digirc
+*/
+
+#include <string.h>
+#include "plugin.h"
+#include <circa_txtbuf_utf8.h>
+
+static void cat_view(TxtBuf *out, PluginView v) {
+  txtbuf_cat_mem(out, v.data, v.len);
+}
+
+static bool cmd_ping(const PluginCall *call, TxtBuf *out) {
+  (void) call;
+  return txtbuf_cat_cstr(out, "pong") == CE_OK;
+}
+
+static bool cmd_time(const PluginCall *call, TxtBuf *out) {
+  (void) call;
+  return txtbuf_cat_cstr(out, "for you to get a watch") == CE_OK;
+}
+
+static bool cmd_hello(const PluginCall *call, TxtBuf *out) {
+  (void) call;
+  return txtbuf_cat_cstr(out, "Hello allo") == CE_OK;
+}
+
+static bool cmd_say(const PluginCall *call, TxtBuf *out) {
+  cat_view(out, call->args);
+  return true;
+}
+
+static bool cmd_yell(const PluginCall *call, TxtBuf *out) {
+  cat_view(out, call->args);
+  return txtbuf_utf8_upper(out) == CE_OK;
+}
+
+static bool cmd_whoami(const PluginCall *call, TxtBuf *out) {
+  cat_view(out, call->nick);
+  return true;
+}
+
+// Spaces out every character, keeping multibyte ones whole.
+static bool cmd_aesthetic(const PluginCall *call, TxtBuf *out) {
+  const char *s = call->args.data;
+  size_t len = call->args.len;
+  for (size_t i = 0; i < len; ) {
+    size_t n = txtbuf_utf8_seq(s + i, len - i);
+    if (!n)
+      n = 1;
+    if (i)
+      txtbuf_push(out, ' ');
+    txtbuf_cat_mem(out, s + i, n);
+    i += n;
+  }
+  return true;
+}
+
+// Alternates lower and upper case by character. Spaces don't count, slashes
+// flip, and every other '?' or '!' turns upside down.
+static bool cmd_mock(const PluginCall *call, TxtBuf *out) {
+  const char *s = call->args.data;
+  size_t len = call->args.len;
+  bool up = false;
+  for (size_t i = 0; i < len; ) {
+    uint32_t cp;
+    size_t n = txtbuf_utf8_decode(s + i, len - i, &cp);
+    if (!n) {
+      txtbuf_push(out, s[i++]);
+      continue;
+    }
+    i += n;
+    switch (cp) {
+      case ' ': break;
+      case '/': cp = '\\'; break;
+      case '\\': cp = '/'; break;
+      case '?': cp = up ? '?' : 0xBF; up = !up; break;
+      case '!': cp = up ? '!' : 0xA1; up = !up; break;
+      default:
+        cp = up ? txtbuf_cp_upper(cp) : txtbuf_cp_lower(cp);
+        up = !up;
+    }
+    txtbuf_cat_cp(out, cp);
+  }
+  return true;
+}
+
+static const PluginCmd cmds[] = {
+  {".ping", cmd_ping},
+  {".time", cmd_time},
+  {".hello", cmd_hello},
+  {".say", cmd_say},
+  {".yell", cmd_yell},
+  {".whoami", cmd_whoami},
+  {".aesthetic", cmd_aesthetic},
+  {".mock", cmd_mock},
+  {".spongebob", cmd_mock},
+  {NULL, NULL}
+};
+
+const PluginInfo digirc_plugin = {DIGIRC_PLUGIN_ABI, "basic", cmds};
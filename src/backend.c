@@ -0,0 +1,60 @@
+/*
+** backend.c | Digi's IRC Bot | The Idris backend, linked in.
+** https://github.com/davidgarland/digirc
+*/
+
+#include "digirc.h"
+
+/*
+** Built with `make IDRIS=1`, the backend's runCmd is compiled into the bot as
+** an object exporting digirc_run_cmd, and backend commands become a function
+** call: no process to start, no command line to quote and no message for the
+** backend to parse back apart. One Idris VM is set up at startup and serves
+** every call after it.
+**
+** Without it, or when DIGIRC_BACKEND names a program to run, backend_run
+** declines and commands are spawned as jobs like before.
+**
+** The linked call runs on the event loop itself, so it is bound by neither
+** the job deadline nor a job cgroup: a command that hangs stalls the bot.
+** This build is experimental and has not been compiled against a current
+** Idris toolchain.
+*/
+
+#ifdef DIGIRC_IDRIS
+
+#include <stdlib.h>
+#include "backend_ffi.h"
+
+static VM *backend_vm;
+
+bool backend_init(void) {
+  if (getenv("DIGIRC_BACKEND"))
+    return false;
+  backend_vm = idris_vm();
+  printf("[IDRS] Backend linked in\n");
+  return true;
+}
+
+// The string runCmd hands back lives on the VM's heap, which the next call
+// may collect, so it is copied out straight away.
+bool backend_run(const char *origin, const char *nick, const char *cmd, const char *args, TxtBuf *out) {
+  if (!backend_vm)
+    return false;
+  char *s = digirc_run_cmd(backend_vm, (char *) origin, (char *) nick, (char *) cmd, (char *) args);
+  txtbuf_cpy_cstr(out, s);
+  return true;
+}
+
+#else
+
+bool backend_init(void) {
+  return false;
+}
+
+bool backend_run(const char *origin, const char *nick, const char *cmd, const char *args, TxtBuf *out) {
+  (void) origin, (void) nick, (void) cmd, (void) args, (void) out;
+  return false;
+}
+
+#endif // DIGIRC_IDRIS
@@ -0,0 +1,172 @@
+/*
+** bridge.c | Digi's IRC Bot | Relay bridge table.
+** https://github.com/davidgarland/digirc
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <regex.h>
+#include "digirc.h"
+
+/*
+** Each relay bot gets one slot, keyed by its exact nick. The table is open
+** addressed with linear probing, so a lookup for an ordinary user is a single
+** hash of their nick and (almost always) one empty-slot probe. Relays that
+** come back as "ORENetwork_" or "OREDiscord2" after a reconnect are matched
+** by prefix instead; those few entries are also kept in a list that is
+** checked when the exact lookup misses. Only underscores and digits may
+** follow the prefix, which is what a reconnect adds, so "ORENetworkX" is an
+** ordinary user and can't pose as the relay.
+*/
+
+#define BRIDGE_SLOTS 64
+
+typedef struct {
+  char *nick;
+  size_t nick_len;
+  regex_t pat;
+  enum server sv;
+  bool prefix;
+} Bridge;
+
+static Bridge bridge_tab[BRIDGE_SLOTS];
+static size_t bridge_count;
+static Bridge *bridge_prefixes[BRIDGE_SLOTS];
+static size_t bridge_prefix_count;
+
+static uint32_t bridge_hash(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char) s[i]) * 16777619u;
+  return h;
+}
+
+static bool bridge_suffix(const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    if ((s[i] != '_') && !isdigit((unsigned char) s[i]))
+      return false;
+  return true;
+}
+
+static Bridge *bridge_find(const char *nick, size_t len) {
+  uint32_t h = bridge_hash(nick, len);
+  for (size_t n = 0; n < BRIDGE_SLOTS; n++) {
+    Bridge *b = &bridge_tab[(h + n) & (BRIDGE_SLOTS - 1)];
+    if (!b->nick)
+      break;
+    if ((b->nick_len == len) && !memcmp(b->nick, nick, len))
+      return b;
+  }
+  for (size_t i = 0; i < bridge_prefix_count; i++) {
+    Bridge *b = bridge_prefixes[i];
+    if ((b->nick_len <= len) && !memcmp(b->nick, nick, b->nick_len) && bridge_suffix(nick + b->nick_len, len - b->nick_len))
+      return b;
+  }
+  return NULL;
+}
+
+enum server sv_find(const char *name) {
+  for (int i = 0; i < SV_LENGTH; i++)
+    if (!strcmp(sv_name[i], name))
+      return i;
+  return SV_NONE;
+}
+
+bool bridge_add(const char *nick, enum server sv, const char *pattern) {
+  size_t len = strlen(nick);
+  bool prefix = len && (nick[len - 1] == '*');
+  if (prefix)
+    len--;
+  if ((bridge_count >= BRIDGE_SLOTS / 2) || bridge_find(nick, len))
+    return false;
+
+  uint32_t h = bridge_hash(nick, len);
+  Bridge *b;
+  for (size_t n = 0; ; n++) {
+    b = &bridge_tab[(h + n) & (BRIDGE_SLOTS - 1)];
+    if (!b->nick)
+      break;
+  }
+
+  if (regcomp(&b->pat, pattern, REG_EXTENDED))
+    return false;
+  if (b->pat.re_nsub < 2) {
+    regfree(&b->pat);
+    return false;
+  }
+
+  b->nick = strndup(nick, len);
+  b->nick_len = len;
+  b->sv = sv;
+  b->prefix = prefix;
+  if (prefix)
+    bridge_prefixes[bridge_prefix_count++] = b;
+  bridge_count++;
+  return true;
+}
+
+/*
+** Config lines look like "<relay nick> <server> <pattern>", where the pattern
+** is a POSIX extended regex whose first group is the real sender and whose
+** second group is the real message. A nick ending in '*' matches any nick
+** that starts with the rest of it. Blank lines and '#' comments are skipped.
+*/
+
+void bridge_load(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    printf("[BRDG] No bridge table at %s\n", path);
+    return;
+  }
+
+  TxtBuf line = txtbuf_init();
+  txtbuf_alloc(&line, 128);
+
+  bool eof = false;
+  for (size_t lineno = 1; !eof; lineno++) {
+    eof = txtbuf_readline(&line, fp) == CE_EOF;
+
+    char *nick = strtok(line.data, " \t");
+    if (!nick || (nick[0] == '#'))
+      continue;
+    char *server = strtok(NULL, " \t");
+    char *pattern = server ? strtok(NULL, "") : NULL;
+    if (pattern)
+      pattern += strspn(pattern, " \t");
+
+    enum server sv = server ? sv_find(server) : SV_NONE;
+    if (!pattern || !*pattern || (sv == SV_NONE) || !bridge_add(nick, sv, pattern))
+      printf("[BRDG] %s:%zu: invalid bridge entry\n", path, lineno);
+    else
+      printf("[BRDG] %s => %s\n", nick, sv_name[sv]);
+  }
+
+  txtbuf_free(&line);
+  fclose(fp);
+}
+
+/*
+** Finds the real sender and text of a relayed line. The pattern runs over msg
+** where it already sits (REG_STARTEND, so it needn't be NUL-terminated) and
+** the result points into it; lines from anyone but a relay come back as they
+** went in.
+*/
+
+enum server bridge_match(PluginView nick, PluginView msg, PluginView *who, PluginView *text) {
+  *who = nick;
+  *text = msg;
+  Bridge *b = bridge_find(nick.data, nick.len);
+  if (!b)
+    return SV_IRC;
+
+  regmatch_t m[3];
+  m[0].rm_so = 0;
+  m[0].rm_eo = msg.len;
+  if (regexec(&b->pat, msg.data, 3, m, REG_STARTEND) || (m[1].rm_so < 0) || (m[2].rm_so < 0))
+    return b->sv;
+
+  *who = (PluginView) {msg.data + m[1].rm_so, m[1].rm_eo - m[1].rm_so};
+  *text = (PluginView) {msg.data + m[2].rm_so, m[2].rm_eo - m[2].rm_so};
+  return b->sv;
+}
@@ -0,0 +1,216 @@
+/*
+** cgroup.c | Digi's IRC Bot | cgroup v2 budgets for jobs.
+** https://github.com/davidgarland/digirc
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "digirc.h"
+
+/*
+** Given a cgroup v2 directory it may manage (DIGIRC_CGROUP), the bot splits
+** it in two:
+**
+**   <root>/bot        the bot itself, with a high cpu.weight
+**   <root>/jobs       every child, under one cpu.max, memory.max and pids.max
+**   <root>/jobs/<n>   one leaf per job, so its usage can be read back alone
+**
+** The bot has to leave <root> before controllers can be enabled below it, as
+** cgroup v2 keeps processes out of any group that has controllers enabled for
+** its children. Anything that can't be set up (a missing controller, a
+** read-only tree) is logged and skipped; jobs still run, just without that
+** limit.
+*/
+
+static int cg_root = -1;
+static int cg_jobs = -1;
+
+// A killed leaf takes a moment to empty, and the bot can't sit and wait for
+// it, so leaves that are still busy when their job ends go on a list that a
+// timer works through.
+#define CG_REAP_MAX 64
+#define CG_REAP_MS 10
+#define CG_REAP_TRIES 100
+
+static struct {
+  unsigned long id;
+  int tries;
+} cg_reap[CG_REAP_MAX];
+static size_t cg_reap_count;
+static Timer cg_reap_timer;
+
+static bool cg_write(int dir, const char *file, const char *val) {
+  int fd = openat(dir, file, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  bool ok = write(fd, val, strlen(val)) == (ssize_t) strlen(val);
+  close(fd);
+  return ok;
+}
+
+static bool cg_read(int dir, const char *file, char *buf, size_t len) {
+  int fd = openat(dir, file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  ssize_t n = read(fd, buf, len - 1);
+  close(fd);
+  if (n < 0)
+    return false;
+  buf[n] = '\0';
+  return true;
+}
+
+static int cg_mkdir(int dir, const char *name) {
+  if (mkdirat(dir, name, 0755) && (errno != EEXIST))
+    return -1;
+  return openat(dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Kills whatever is left in a leaf and removes it; false if it is still busy.
+static bool cg_rmdir(const char *name) {
+  int dir = openat(cg_jobs, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir >= 0) {
+    cg_write(dir, "cgroup.kill", "1");
+    close(dir);
+  }
+  return !unlinkat(cg_jobs, name, AT_REMOVEDIR) || (errno != EBUSY);
+}
+
+static bool cg_rmdir_id(unsigned long id) {
+  char name[32];
+  snprintf(name, sizeof(name), "%lu", id);
+  return cg_rmdir(name);
+}
+
+static void cg_reap_run(Timer *t) {
+  size_t n = 0;
+  for (size_t i = 0; i < cg_reap_count; i++) {
+    if (cg_rmdir_id(cg_reap[i].id))
+      continue;
+    if (++cg_reap[i].tries == CG_REAP_TRIES) {
+      printf("[CGRP] jobs/%lu won't empty, leaving it\n", cg_reap[i].id);
+      continue;
+    }
+    cg_reap[n++] = cg_reap[i];
+  }
+  cg_reap_count = n;
+  if (n)
+    timer_arm(t, CG_REAP_MS);
+}
+
+// Leaves left behind by an earlier run would otherwise be picked up again by
+// jobs with the same ids, along with their old usage. This is before the bot
+// is connected, so it can afford to wait for them.
+static void cg_clear_stale(void) {
+  DIR *d = fdopendir(dup(cg_jobs));
+  if (!d)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d))) {
+    if ((e->d_type != DT_DIR) || (e->d_name[0] == '.'))
+      continue;
+    for (int i = 0; (i < CG_REAP_TRIES) && !cg_rmdir(e->d_name); i++)
+      usleep(1000);
+  }
+  closedir(d);
+}
+
+static void cg_set(int dir, const char *file, const char *env, const char *fallback) {
+  const char *val = env_or(env, fallback);
+  if (!cg_write(dir, file, val))
+    printf("[CGRP] Couldn't set %s to %s: %s\n", file, val, strerror(errno));
+}
+
+// Enables each controller on its own, so one that's missing doesn't take the
+// others down with it.
+static void cg_enable(int dir) {
+  static const char *ctl[] = {"+cpu", "+memory", "+pids"};
+  for (size_t i = 0; i < sizeof(ctl) / sizeof(ctl[0]); i++)
+    if (!cg_write(dir, "cgroup.subtree_control", ctl[i]))
+      printf("[CGRP] Couldn't enable %s: %s\n", ctl[i] + 1, strerror(errno));
+}
+
+bool cgroup_init(void) {
+  const char *path = getenv("DIGIRC_CGROUP");
+  if (!path || !*path)
+    return false;
+  cg_root = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  int bot = cg_root < 0 ? -1 : cg_mkdir(cg_root, "bot");
+  if ((bot < 0) || !cg_write(bot, "cgroup.procs", "0")) {
+    printf("[CGRP] Can't use %s: %s\n", path, strerror(errno));
+    if (bot >= 0)
+      close(bot);
+    if (cg_root >= 0)
+      close(cg_root);
+    cg_root = -1;
+    return false;
+  }
+
+  cg_enable(cg_root);
+  cg_set(bot, "cpu.weight", "DIGIRC_CGROUP_WEIGHT", "1000");
+  close(bot);
+
+  cg_jobs = cg_mkdir(cg_root, "jobs");
+  if (cg_jobs < 0) {
+    printf("[CGRP] Couldn't create %s/jobs: %s\n", path, strerror(errno));
+    return false;
+  }
+  cg_clear_stale();
+  cg_reap_timer.fn = cg_reap_run;
+  cg_enable(cg_jobs);
+  cg_set(cg_jobs, "cpu.max", "DIGIRC_CGROUP_CPU", "200000 100000");
+  cg_set(cg_jobs, "memory.max", "DIGIRC_CGROUP_MEM", "1G");
+  cg_set(cg_jobs, "pids.max", "DIGIRC_CGROUP_PIDS", "256");
+  // Swapping a runaway eval out only makes the whole host slow.
+  cg_write(cg_jobs, "memory.swap.max", "0");
+  printf("[CGRP] Jobs run under %s/jobs\n", path);
+  return true;
+}
+
+// A fresh leaf per job, so memory.peak starts from nothing each time. One that
+// already exists is never reused, as it would carry someone else's usage.
+int cgroup_job_open(unsigned long id) {
+  if (cg_jobs < 0)
+    return -1;
+  char name[32];
+  snprintf(name, sizeof(name), "%lu", id);
+  if (mkdirat(cg_jobs, name, 0755)) {
+    printf("[CGRP] Couldn't create jobs/%s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  return openat(cg_jobs, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Reads the leaf's usage, clears out anything the job left running, and
+// removes it. Fields the kernel doesn't provide are left as they were, and
+// mem_known only gets set when memory.peak could be read.
+void cgroup_job_close(int dir, unsigned long id, JobUsage *use) {
+  char buf[1024];
+  if (cg_read(dir, "cpu.stat", buf, sizeof(buf))) {
+    char *p = strstr(buf, "usage_usec ");
+    if (p)
+      use->cpu_ms = strtoull(p + 11, NULL, 10) / 1e3;
+  }
+  if (cg_read(dir, "memory.peak", buf, sizeof(buf))) {
+    use->mem_peak = strtoull(buf, NULL, 10);
+    use->mem_known = true;
+  }
+
+  cg_write(dir, "cgroup.kill", "1");
+  close(dir);
+  if (cg_rmdir_id(id))
+    return;
+  if (cg_reap_count == CG_REAP_MAX) {
+    printf("[CGRP] Too many leaves emptying, leaving jobs/%lu\n", id);
+    return;
+  }
+  cg_reap[cg_reap_count++].id = id;
+  cg_reap[cg_reap_count - 1].tries = 0;
+  if (!timer_armed(&cg_reap_timer))
+    timer_arm(&cg_reap_timer, CG_REAP_MS);
+}
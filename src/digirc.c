@@ -3,6 +3,7 @@
 ** https://github.com/davidgarland/digirc
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -10,6 +11,13 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sched.h>
 
 #include "digirc.h"
 
@@ -19,94 +27,644 @@ TxtBuf nick;
 TxtBuf msg;
 enum server sv;
 
-void irc_cmd(TxtBuf *res, TxtBuf *cmd) {
-  FILE *fp = popen(cmd->data, "r");
-  printf("[CMDS]: %s\n", cmd->data);
-  txtbuf_read(res, fp);
-  printf("[RSLT]: %s", res->data);
-  pclose(fp);
+/*
+** Jobs. Every command that runs a child is a job: its stdout pipe is watched
+** by the I/O engine and the output is handled as it arrives, so the bot keeps
+** reading from the server while commands run. Each child leads its own
+** process group and has a deadline; one that runs past it is killed along
+** with everything it started, which ends the job through the usual EOF. One
+** whose output overflows what ".more" will hold is killed the same way, and
+** its pipe isn't read any further.
+*/
+
+#define JOB_MAX 8
+#define JOB_OUT_MAX 8192
+#define JOB_HOLD 128
+
+typedef struct {
+  bool used;
+  enum cmd kind;
+  pid_t pid;
+  int fd;
+  unsigned long id;
+  int cg;
+  Timer deadline;
+  bool late;
+  IrcStream st;
+  TxtBuf out;
+  char head[2];
+  size_t head_len;
+  size_t line;
+  size_t bytes;
+  bool started;
+  bool quiet;
+  bool fed;
+} Job;
+
+static Job jobs[JOB_MAX];
+
+// What the last reply with too many lines held back, for .more. It is moved
+// out of the stream that produced it, so the job slot or the in-process
+// stream can be reused without touching it.
+static IrcStream more_st;
+
+static void more_keep(IrcStream *st) {
+  if (!st->more.len)
+    return;
+  if (!more_st.prefix.data)
+    irc_stream_init(&more_st, IRC_LINE_CAP);
+  irc_stream_keep(&more_st, st);
 }
 
-void mueval(TxtBuf *res, bool type, TxtBuf *cmd, TxtBuf *args) {
-  txtbuf_fmt(cmd, "stack exec -- mueval --module Data.Complex --module Data.Void --module Data.List --module Data.Tree --module Data.Functor --module Control.Monad --module Control.Comonad --module Control.Lens --module Data.Monoid --module Data.Semigroup -t 20 %s -e %s +RTS -N2 -RTS", type ? "--inferred-type -T" : "", args->data);
-  FILE *fp = popen(cmd->data, "r");
-  if (!fp) {
-    txtbuf_cpy_cstr(res, "Error");
+static uint64_t job_timeout_ms;
+static unsigned long job_seq;
+
+// Usage is reported per job, and in aggregate with the [STAT] lines: once for
+// the jobs since the last report and once for the whole session.
+typedef struct {
+  size_t n;
+  double cpu_ms;
+  double cpu_ms_max;
+  size_t mem_n;
+  double mem;
+  double mem_max;
+} JobStat;
+
+static JobStat job_period, job_total;
+
+static void job_stat_add(JobStat *st, JobUsage *use) {
+  st->n++;
+  st->cpu_ms += use->cpu_ms;
+  if (use->cpu_ms > st->cpu_ms_max)
+    st->cpu_ms_max = use->cpu_ms;
+  if (!use->mem_known)
     return;
+  st->mem_n++;
+  st->mem += use->mem_peak;
+  if (use->mem_peak > st->mem_max)
+    st->mem_max = use->mem_peak;
+}
+
+// Moves pid into a job's cgroup.
+static bool job_join(int cg, pid_t pid) {
+  char s[16];
+  int fd = openat(cg, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  int n = snprintf(s, sizeof(s), "%d", (int) pid);
+  bool ok = write(fd, s, n) == n;
+  close(fd);
+  return ok;
+}
+
+/*
+** A child bound for a cgroup is cloned with CLONE_VM | CLONE_VFORK, so it
+** borrows the bot's pages rather than copying its page tables, and the bot is
+** suspended until the child has exec'd. CLONE_INTO_CGROUP would need clone3,
+** which can't be handed a fresh stack from C, so the child joins its cgroup
+** itself before exec, and its first fork still happens inside. It shares the
+** bot's memory, so it sticks to plain syscalls on what the bot set up for it:
+** cgroup.procs is opened beforehand, the child writes "0" (itself) to it, and
+** all it hands back is whether that worked.
+*/
+
+typedef struct {
+  int procs;
+  int out;
+  char **argv;
+  bool joined;
+} JobChild;
+
+// Only one child runs on this at a time, as the bot waits for it to exec.
+static char job_stack[64 * 1024] __attribute__((aligned(16)));
+
+static int job_child(void *arg) {
+  JobChild *c = arg;
+  setpgid(0, 0);
+  c->joined = write(c->procs, "0", 1) == 1;
+  dup2(c->out, STDOUT_FILENO);
+  execve("/bin/sh", c->argv, environ);
+  _exit(127);
+}
+
+static pid_t job_clone(int cg, int out, char **argv) {
+  static bool clone_warned, join_warned;
+  JobChild c = {openat(cg, "cgroup.procs", O_WRONLY | O_CLOEXEC), out, argv, false};
+  pid_t pid = -1;
+  if (c.procs >= 0)
+    pid = clone(job_child, job_stack + sizeof(job_stack), CLONE_VM | CLONE_VFORK | SIGCHLD, &c);
+  if (pid < 0) {
+    if (!clone_warned)
+      printf("[CGRP] Couldn't clone into a job cgroup (%s), spawning jobs with posix_spawn\n", strerror(errno));
+    clone_warned = true;
+    if (c.procs >= 0)
+      close(c.procs);
+    return -1;
   }
-  int i = 0;
-  while (txtbuf_readline(res, fp) != CE_EOF) {
-    printf("%i: %s\n", i, res->data);
-    if ((i == 0) && strstr(res->data, "error")) {
-      txtbuf_cpy_cstr(res, "Error");
-      break;
+  close(c.procs);
+
+  if (!c.joined && !job_join(cg, pid) && !join_warned) {
+    printf("[CGRP] Jobs couldn't join their cgroups: %s\n", strerror(errno));
+    join_warned = true;
+  }
+  return pid;
+}
+
+// popen, except that the pid is kept and the child gets its own process group.
+static int job_spawn(const char *cmd, pid_t *pid, int cg) {
+  int p[2];
+  if (pipe2(p, O_CLOEXEC))
+    return -1;
+  char *argv[] = {"sh", "-c", (char *) cmd, NULL};
+  if (cg >= 0) {
+    *pid = job_clone(cg, p[1], argv);
+    if (*pid > 0) {
+      setpgid(*pid, *pid);
+      close(p[1]);
+      return p[0];
     }
-    if ((i == 0) && !type)
-      break;
-    if ((i == 1) && type)
+  }
+
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, p[1], STDOUT_FILENO);
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+  int err = posix_spawn(pid, "/bin/sh", &fa, &attr, argv, environ);
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&attr);
+  close(p[1]);
+  if (err) {
+    close(p[0]);
+    return -1;
+  }
+  if (cg >= 0)
+    job_join(cg, *pid);
+  return p[0];
+}
+
+static void job_late(Timer *t) {
+  Job *j = t->arg;
+  printf("[JOBS] %d ran past its deadline, killing it\n", (int) j->pid);
+  j->late = true;
+  kill(-j->pid, SIGKILL);
+}
+
+static Job *job_find(int fd) {
+  for (size_t i = 0; i < JOB_MAX; i++)
+    if (jobs[i].used && (jobs[i].fd == fd))
+      return &jobs[i];
+  return NULL;
+}
+
+// The one-line "nick => text" reply, sent straight from the nick buffer.
+static void irc_reply(int conn, const char *text) {
+  IrcVec v;
+  irc_vec_init(&v);
+  irc_vec_cstr(&v, "PRIVMSG " CHANNEL " :");
+  irc_vec_add(&v, nick.data, nick.len);
+  irc_vec_cstr(&v, " => ");
+  irc_vec_cstr(&v, text);
+  irc_say(conn, &v);
+}
+
+static Job *job_start(int conn, enum cmd kind, TxtBuf *cmd) {
+  Job *j = NULL;
+  for (size_t i = 0; (i < JOB_MAX) && !j; i++)
+    if (!jobs[i].used)
+      j = &jobs[i];
+  if (!j) {
+    irc_reply(conn, "Busy, try again in a moment.");
+    return NULL;
+  }
+
+  pid_t pid;
+  unsigned long id = job_seq++;
+  int cg = cgroup_job_open(id);
+  int fd = job_spawn(cmd->data, &pid, cg);
+  printf("[CMDS]: %s\n", cmd->data);
+  if (fd < 0) {
+    if (cg >= 0)
+      cgroup_job_close(cg, id, &(JobUsage) {0});
+    return NULL;
+  }
+
+  if (!j->out.data) {
+    irc_stream_init(&j->st, IRC_LINE_CAP);
+    j->out = txtbuf_init();
+    txtbuf_alloc(&j->out, 256);
+  }
+  j->used = true;
+  j->kind = kind;
+  j->pid = pid;
+  j->fd = fd;
+  j->id = id;
+  j->cg = cg;
+  j->late = false;
+  j->head_len = 0;
+  j->line = 0;
+  j->bytes = 0;
+  j->started = false;
+  j->quiet = false;
+  j->fed = false;
+  txtbuf_clear(&j->out);
+  if (kind == CMD_BACKEND)
+    irc_stream_begin(&j->st, conn, CHANNEL, nick.data, " ");
+  else
+    irc_stream_begin(&j->st, conn, CHANNEL, nick.data, " => ");
+  io_watch(j->fd, IO_PIPE);
+  j->deadline.fn = job_late;
+  j->deadline.arg = j;
+  timer_arm(&j->deadline, job_timeout_ms);
+  return j;
+}
+
+/*
+** mueval prints the value on its first line; with -T the first line echoes
+** the expression and the second holds the type. A first line with "error" in
+** it means the expression didn't compile, so the start of it is held back
+** until that is settled: all of it for .type, where it is only the echo, and
+** up to JOB_HOLD bytes for .eval, where it is the value itself and may never
+** end. After that the wanted line streams out as it arrives.
+*/
+
+static void mueval_feed(Job *j, const char *s, size_t len) {
+  size_t want = j->kind == CMD_TYPE ? 1 : 0;
+  while (len) {
+    const char *nl = memchr(s, '\n', len);
+    size_t n = nl ? (size_t) (nl - s) : len;
+    if (!j->started) {
+      if (j->out.len + n < JOB_OUT_MAX)
+        txtbuf_cat_mem(&j->out, s, n);
+      if (nl || (!want && (j->out.len >= JOB_HOLD))) {
+        j->started = true;
+        j->quiet = strstr(j->out.data, "error") != NULL;
+        if (j->quiet || !want)
+          irc_stream_feed(&j->st, j->quiet ? "Error" : j->out.data, j->quiet ? 5 : j->out.len);
+        j->fed = j->quiet || j->out.len;
+      }
+    } else if ((j->line == want) && !j->quiet) {
+      irc_stream_feed(&j->st, s, n);
+      j->fed |= n > 0;
+    }
+    if (!nl)
       break;
-    i++;
+    j->line++;
+    s += n + 1;
+    len -= n + 1;
+  }
+}
+
+/*
+** Backend output streams straight through. The backend answers "OK" when it
+** has nothing to say, so the first two bytes are held back until that can be
+** ruled out.
+*/
+
+static void job_feed(Job *j, const char *s, size_t len) {
+  if (j->kind != CMD_BACKEND) {
+    mueval_feed(j, s, len);
+    return;
+  }
+
+  if (!j->started) {
+    while (len && (j->head_len < 2)) {
+      j->head[j->head_len++] = *s++;
+      len--;
+    }
+    if (j->head_len < 2)
+      return;
+    j->started = true;
+    j->quiet = !strncmp(j->head, "OK", 2);
+    if (!j->quiet)
+      irc_stream_feed(&j->st, j->head, 2);
+  }
+  if (!j->quiet)
+    irc_stream_feed(&j->st, s, len);
+}
+
+static void job_end(Job *j) {
+  io_unwatch(j->fd);
+  close(j->fd);
+  timer_cancel(&j->deadline);
+  int status;
+  struct rusage ru;
+  if (j->st.full) {
+    printf("[JOBS] %d filled the .more buffer, killing it\n", (int) j->pid);
+    kill(-j->pid, SIGKILL);
+  }
+  wait4(j->pid, &status, 0, &ru);
+
+  // wait4 covers the shell and whatever it waited for. Its maxrss would be
+  // the peak, except that a child spawned with vfork counts the bot's own
+  // pages in it, so memory is only reported from the cgroup's memory.peak.
+  JobUsage use = {
+    .cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3
+  };
+  if (j->cg >= 0)
+    cgroup_job_close(j->cg, j->id, &use);
+  job_stat_add(&job_period, &use);
+  job_stat_add(&job_total, &use);
+  char mem[32] = "n/a";
+  if (use.mem_known)
+    snprintf(mem, sizeof(mem), "%.1f MiB", use.mem_peak / 1048576.0);
+  printf("[STAT] job %lu (%s): %.1f ms cpu, %s peak\n", j->id,
+    j->kind == CMD_BACKEND ? "backend" : "mueval", use.cpu_ms, mem);
+  // The output itself goes to the channel, not the log.
+  printf("[RSLT] job %lu: %zu bytes, truncated: %s\n", j->id, j->bytes, j->st.full ? "yes" : "no");
+
+  if (j->kind == CMD_BACKEND) {
+    if (j->late) {
+      const char *note = "\n=> Timed out.";
+      if (!j->started && !j->head_len)
+        note++;
+      job_feed(j, note, strlen(note));
+    }
+    if (!j->quiet) {
+      irc_stream_feed(&j->st, j->head, j->started ? 0 : j->head_len);
+      irc_stream_end(&j->st);
+    }
+  } else {
+    // A first line that never ended is settled now, and a run that failed
+    // or was cut short says so after whatever already went out. One killed
+    // for its output already says so through the stream.
+    if (!j->started)
+      mueval_feed(j, "\n", 1);
+    const char *note = j->late ? "\nTimed out." : (status && !j->quiet && !j->st.full) ? "\nError" : "";
+    if (*note && !j->fed)
+      note++;
+    irc_stream_feed(&j->st, note, strlen(note));
+    irc_stream_end(&j->st);
   }
-  if (pclose(fp)) {
+
+  more_keep(&j->st);
+  j->used = false;
+}
+
+void mueval(TxtBuf *cmd, bool type, TxtBuf *args) {
+  txtbuf_cpy_cstr(cmd, "stack exec -- mueval --module Data.Complex --module Data.Void --module Data.List --module Data.Tree --module Data.Functor --module Control.Monad --module Control.Comonad --module Control.Lens --module Data.Monoid --module Data.Semigroup -t 20 ");
+  txtbuf_cat_cstr(cmd, type ? "--inferred-type -T -e " : " -e ");
+  txtbuf_cat(cmd, args);
+  txtbuf_cat_cstr(cmd, " +RTS -N2 -RTS");
+}
+
+/*
+** In-process commands: plugins, and the backend when it is linked in. They
+** finish before the next line is read, so they can all answer through one
+** stream.
+*/
+
+static IrcStream local_st;
+
+static void local_reply(int conn, TxtBuf *res) {
+  printf("[RSLT] %zu bytes\n", res->len);
+  if (!local_st.prefix.data)
+    irc_stream_init(&local_st, IRC_LINE_CAP);
+  irc_stream_begin(&local_st, conn, CHANNEL, nick.data, " => ");
+  irc_stream_feed(&local_st, res->data, res->len);
+  irc_stream_end(&local_st);
+  more_keep(&local_st);
+}
+
+// The call holds a reference on the module for as long as the handler runs,
+// so swapping it mid-call is safe.
+static void plugin_run(int conn, TxtBuf *res) {
+  size_t sp;
+  txtbuf_find(&msg, 0, ' ', &sp);
+  size_t skip = sp < msg.len ? sp + 1 : sp;
+  PluginCall call = {
+    .origin = sv,
+    .nick = {nick.data, nick.len},
+    .cmd = {msg.data, sp},
+    .args = {msg.data + skip, msg.len - skip}
+  };
+
+  PluginFn fn;
+  Plugin *p = plugin_acquire(call.cmd.data, call.cmd.len, &fn);
+  if (!p)
+    return;
+  txtbuf_clear(res);
+  bool ok = fn(&call, res);
+  plugin_release(p);
+  if (!ok)
     txtbuf_cpy_cstr(res, "Error");
+  if (res->len)
+    local_reply(conn, res);
+}
+
+// Set when the backend is linked in rather than spawned.
+static bool backend_linked;
+
+// The linked backend gets the command split where the message already has its
+// first space, and answers "OK" when it has nothing to say.
+static bool backend_call(int conn, TxtBuf *res) {
+  size_t sp;
+  txtbuf_find(&msg, 0, ' ', &sp);
+  bool cut = sp < msg.len;
+  if (cut)
+    msg.data[sp] = '\0';
+  bool ran = backend_run(sv_name[sv], nick.data, msg.data, cut ? msg.data + sp + 1 : "", res);
+  if (cut)
+    msg.data[sp] = ' ';
+  if (ran && strcmp(res->data, "OK"))
+    local_reply(conn, res);
+  return ran;
+}
+
+/*
+** Stats. Every STAT_LINES lines the bot reports how many I/O syscalls and how
+** much of its own CPU time the lines cost, which is what the I/O engines are
+** compared on.
+*/
+
+#define STAT_LINES 10000
+
+static size_t stat_lines;
+
+static void stat_report(bool final) {
+  static size_t lines0, sys0;
+  static double cpu0;
+  // The final report covers the whole session rather than a short tail.
+  if (final)
+    lines0 = sys0 = cpu0 = 0;
+  size_t n = stat_lines - lines0;
+  if (!n || (!final && (n < STAT_LINES)))
+    return;
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  double cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+  printf("[STAT] %s%s: %zu lines, %.2f syscalls/line, %.1f ms cpu/10k lines\n",
+    io_name(), final ? " total" : "", n, (double) (io_syscalls - sys0) / n, (cpu - cpu0) / n * 1e4);
+  JobStat *js = final ? &job_total : &job_period;
+  if (js->n && js->mem_n)
+    printf("[STAT] %s%zu jobs: %.1f ms cpu avg, %.1f max; %.1f MiB peak avg, %.1f max\n", final ? "total: " : "", js->n,
+      js->cpu_ms / js->n, js->cpu_ms_max, js->mem / js->mem_n / 1048576.0, js->mem_max / 1048576.0);
+  else if (js->n)
+    printf("[STAT] %s%zu jobs: %.1f ms cpu avg, %.1f max; peak memory n/a\n", final ? "total: " : "", js->n,
+      js->cpu_ms / js->n, js->cpu_ms_max);
+  job_period = (JobStat) {0};
+  fflush(stdout);
+  lines0 = stat_lines;
+  sys0 = io_syscalls;
+  cpu0 = cpu;
+}
+
+/*
+** Keepalive. Anything from the server shows the connection is alive; after an
+** interval of silence the bot sends its own PING, and a second silent
+** interval means the connection is dead, however quiet TCP is about it.
+*/
+
+static Timer keepalive;
+static uint64_t keepalive_ms;
+static int keepalive_conn;
+static bool keepalive_heard;
+static bool keepalive_pinged;
+static bool keepalive_dead;
+
+static void keepalive_check(Timer *t) {
+  if (keepalive_heard) {
+    keepalive_heard = false;
+    keepalive_pinged = false;
+  } else if (!keepalive_pinged) {
+    irc_send(keepalive_conn, "PING :digirc\r\n");
+    keepalive_pinged = true;
+  } else {
+    printf("[DISC] No reply to PING\n");
+    keepalive_dead = true;
+    return;
+  }
+  timer_arm(t, keepalive_ms);
+}
+
+/*
+** Main loop
+*/
+
+static TxtBuf args, args_esc, cmd, res;
+
+static void irc_handle(int conn, TxtBuf *buf) {
+  stat_lines++;
+  stat_report(false);
+
+  if (!strncmp(buf->data, "PING", 4)) {
+    buf->data[1] = 'O';
+    irc_send_buf(conn, buf);
     return;
   }
+
+  sv = irc_info(buf, &nick, &msg);
+
+  // Clients that don't send UTF-8 are almost always sending Latin-1; convert
+  // it so that everything after this only ever sees UTF-8.
+  bool utf8;
+  txtbuf_utf8_valid(&msg, &utf8);
+  if (!utf8) {
+    txtbuf_clear(&args);
+    txtbuf_cat_latin1(&args, &msg);
+    txtbuf_cpy(&msg, &args);
+  }
+
+  printf("[RECV] %s | %s: %s\n", sv_name[sv], nick.data, msg.data);
+  enum cmd c = irc_dispatch(&nick, &msg);
+  switch (c) {
+    case CMD_NONE:
+      break;
+    case CMD_RELOAD:
+      // A linked backend is part of the binary; rebuilding ./backend would
+      // only stall the bot for the length of the compile and change nothing.
+      if (backend_linked)
+        irc_reply(conn, "The backend is linked in; rebuild and restart the bot to change it.");
+      else
+        system("idris --O2 src/backend.idr -o backend");
+      break;
+    case CMD_MORE:
+      irc_stream_more(&more_st);
+      break;
+    case CMD_SWAP:
+      irc_reply(conn, plugin_swap(msg.data + 6) ? "Swapped." : "No such plugin, or it failed to load.");
+      break;
+    case CMD_PLUGIN:
+      plugin_run(conn, &res);
+      break;
+    case CMD_EVAL:
+    case CMD_TYPE:
+      txtbuf_cpy_cstr(&args, msg.data + 6);
+      shell_esc(&args_esc, &args);
+      mueval(&cmd, c == CMD_TYPE, &args_esc);
+      job_start(conn, c, &cmd);
+      break;
+    case CMD_BACKEND:
+      if (backend_call(conn, &res))
+        break;
+      txtbuf_cpy_cstr(&args, sv_name[sv]);
+      txtbuf_cat_cstr(&args, " | ");
+      txtbuf_cat(&args, &nick);
+      txtbuf_cat_cstr(&args, ": ");
+      txtbuf_cat(&args, &msg);
+      printf("args: %s\n", args.data);
+      shell_esc(&args_esc, &args);
+      txtbuf_cpy_cstr(&cmd, (char *) env_or("DIGIRC_BACKEND", "./backend"));
+      txtbuf_cat_char(&cmd, ' ');
+      txtbuf_cat(&cmd, &args_esc);
+      job_start(conn, c, &cmd);
+      break;
+  }
 }
 
 void irc_loop(int conn, bool first, TxtBuf *buf) {
-  TxtBuf args = txtbuf_init();
-  TxtBuf args_esc = txtbuf_init();
-  TxtBuf cmd = txtbuf_init();
-  TxtBuf res = txtbuf_init();
-  TxtBuf out = txtbuf_init();
+  while (first) {
+    irc_line(conn, buf);
+    if (!strncmp(buf->data, "PING", 4)) {
+      buf->data[1] = 'O';
+      irc_send_buf(conn, buf);
+      return;
+    }
+    printf("[INIT] %s", buf->data);
+  }
 
   txtbuf_alloc(&args, 1);
   txtbuf_alloc(&args_esc, 1);
   txtbuf_alloc(&cmd, 1);
   txtbuf_alloc(&res, 2049);
-  txtbuf_alloc(&out, 1);
 
-  while (true) {
-    irc_line(conn, buf);
-    if (!strncmp(buf->data, "PING", 4)) {
-      buf->data[1] = 'O';
-      irc_send(conn, buf->data);
-      if (first)
+  // Lines that arrived along with the end of registration come first.
+  while (irc_rx_line(&irc_rx, buf))
+    irc_handle(conn, buf);
+
+  keepalive_conn = conn;
+  keepalive.fn = keepalive_check;
+  timer_arm(&keepalive, keepalive_ms);
+
+  IoEvent ev;
+  while (!keepalive_dead && io_wait(&ev)) {
+    if (ev.fd == conn) {
+      if (ev.len <= 0)
         break;
-    } else if (!first) {
-      sv = irc_info(buf, &nick, &msg);
-      printf("[RECV] %s | %s: %s\n", sv_name[sv], nick.data, msg.data);
-      if (msg.len && msg.data[0] == '.') {
-        if (!strncmp(msg.data, ".reload", 7) && !strncmp(nick.data, "Digi", 4)) {
-          system("idris --O2 src/backend.idr -o backend");
-        } else if (!strncmp(msg.data, ".eval", 5) && msg.len > 6) {
-          txtbuf_cpy_cstr(&args, msg.data + 6);
-          shell_esc(&args_esc, &args);
-          mueval(&res, false, &cmd, &args_esc);
-          txtbuf_fmt(&out, "%s => %s", nick.data, res.data);
-          irc_send(conn, "PRIVMSG " CHANNEL " :%s\r\n", out.data);
-        } else if (!strncmp(msg.data, ".type", 5) && msg.len > 6) {
-          txtbuf_cpy_cstr(&args, msg.data + 6);
-          shell_esc(&args_esc, &args);
-          mueval(&res, true, &cmd, &args_esc);
-          txtbuf_fmt(&out, "%s => %s", nick.data, res.data);
-          irc_send(conn, "PRIVMSG " CHANNEL " :%s\r\n", out.data);
-        } else {
-          txtbuf_fmt(&args, "%s | %s: %s", sv_name[sv], nick.data, msg.data);
-          printf("args: %s\n", args.data);
-          shell_esc(&args_esc, &args);
-          txtbuf_fmt(&cmd, "./backend %s", args_esc.data);
-          irc_cmd(&res, &cmd);
-          if (!strncmp(res.data, "OK", 2))
-            continue;
-          txtbuf_fmt(&out, "%s %s", nick.data, res.data);
-          irc_send(conn, "PRIVMSG " CHANNEL " :%s\r\n", out.data);
-        }
-      }
+      keepalive_heard = true;
+      irc_rx_feed(&irc_rx, ev.data, ev.len);
+      io_done(&ev);
+      while (irc_rx_line(&irc_rx, buf))
+        irc_handle(conn, buf);
+    } else if (ev.fd == timer_fd) {
+      io_done(&ev);
+      timer_run();
     } else {
-      printf("[INIT] %s", buf->data);
+      Job *j = job_find(ev.fd);
+      if (j && (ev.len > 0)) {
+        j->bytes += ev.len;
+        job_feed(j, ev.data, ev.len);
+      }
+      io_done(&ev);
+      if (j && ((ev.len <= 0) || j->st.full))
+        job_end(j);
     }
   }
+
+  stat_report(true);
+  printf("[DISC] Connection closed\n");
 }
 
 int main() {
@@ -117,16 +675,34 @@ int main() {
   txtbuf_alloc(&nick, 1);
   txtbuf_alloc(&msg, 1); 
 
+  bridge_load("bridges.conf");
+  plugin_load_dir(env_or("DIGIRC_PLUGINS", "plugins"));
+  backend_linked = backend_init();
+
   // Connect to the IRC server.
   struct addrinfo hints = {
     .ai_family = AF_INET,
     .ai_socktype = SOCK_STREAM
   };
   struct addrinfo *res;
-  if (getaddrinfo("irc.esper.net", "6667", &hints, &res))
+  if (getaddrinfo(env_or("DIGIRC_HOST", "irc.esper.net"), env_or("DIGIRC_PORT", "6667"), &hints, &res))
     exit(EXIT_FAILURE);
   int conn = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-  connect(conn, res->ai_addr, res->ai_addrlen);
+  if (connect(conn, res->ai_addr, res->ai_addrlen))
+    exit(EXIT_FAILURE);
+
+  io_init();
+  irc_rx_init(&irc_rx);
+  io_watch(conn, IO_SOCKET);
+  if (!timer_init()) {
+    printf("[TIME] Couldn't create a timerfd\n");
+    exit(EXIT_FAILURE);
+  }
+  io_watch(timer_fd, IO_TIMER);
+  irc_flood_init();
+  cgroup_init();
+  job_timeout_ms = strtoul(env_or("DIGIRC_TIMEOUT", "30"), NULL, 10) * 1000;
+  keepalive_ms = strtoul(env_or("DIGIRC_PING", "60"), NULL, 10) * 1000;
   irc_send(conn, "USER digirc 0 0 :digirc\r\n");
   irc_send(conn, "NICK digirc\r\n");
 
@@ -154,5 +730,5 @@ int main() {
   // Run the rest of the main loop.
   irc_loop(conn, false, &buf);
 
-  return EXIT_SUCCESS;
+  return EXIT_FAILURE;
 }
@@ -11,29 +11,185 @@
 #include <netdb.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #define CIRCA_LOGGING
 #include <circa_txtbuf.h>
+#include <circa_txtbuf_utf8.h>
+#include "plugin.h"
 
-enum server {
-  SV_NONE,
-  SV_IRC,
-  SV_DISCORD,
-  SV_NETWORK,
-  SV_LENGTH
+extern char *sv_name[SV_LENGTH];
+
+const char *env_or(const char *name, const char *fallback);
+
+enum cmd {
+  CMD_NONE,
+  CMD_RELOAD,
+  CMD_MORE,
+  CMD_SWAP,
+  CMD_PLUGIN,
+  CMD_EVAL,
+  CMD_TYPE,
+  CMD_BACKEND
 };
 
-extern char *sv_name[SV_LENGTH];
+// The longest line the server will take, including the trailing CRLF.
+#define IRC_MSG_MAX 512
+
+// How many messages one command may send before the rest waits for ".more".
+#define IRC_LINE_CAP 4
+
+// How much output a stream holds back for ".more" before it stops taking any.
+#define IRC_MORE_MAX (16 * IRC_LINE_CAP * IRC_MSG_MAX)
+
+// Segments in one reply line, counting the CRLF that irc_say adds.
+#define IRC_VEC_MAX 8
+
+typedef struct {
+  struct iovec seg[IRC_VEC_MAX];
+  int n;
+  size_t len;
+} IrcVec;
+
+typedef struct {
+  int conn;
+  TxtBuf prefix;
+  TxtBuf line;
+  TxtBuf more;
+  size_t sent;
+  size_t cap;
+  bool full;
+} IrcStream;
+
+typedef struct {
+  TxtBuf buf;
+  size_t off;
+} IrcRx;
+
+extern IrcRx irc_rx;
+
+/*
+** I/O engines. An engine delivers reads from every watched descriptor as a
+** stream of events and takes care of writes; io_init picks one at startup.
+*/
+
+#define IO_WATCH_MAX 64
+#define IO_IOV_MAX 16
+
+enum io_kind {
+  IO_SOCKET,
+  IO_PIPE,
+  IO_TIMER
+};
+
+typedef struct {
+  int fd;
+  ssize_t len; // Bytes read, 0 at EOF, or -errno.
+  char *data;
+  unsigned id;
+} IoEvent;
+
+typedef struct {
+  const char *name;
+  bool (*init)(void);
+  void (*watch)(int fd, enum io_kind kind);
+  void (*unwatch)(int fd);
+  void (*send)(int fd, const struct iovec *iov, int n);
+  bool (*wait)(IoEvent *ev);
+  void (*done)(IoEvent *ev);
+} IoEngine;
+
+extern size_t io_syscalls;
+
+#ifdef DIGIRC_URING
+extern const IoEngine io_uring_engine;
+#endif
+
+void io_init(void);
+const char *io_name(void);
+void io_watch(int fd, enum io_kind kind);
+void io_unwatch(int fd);
+void io_send(int fd, const struct iovec *iov, int n);
+bool io_wait(IoEvent *ev);
+void io_done(IoEvent *ev);
+
+/*
+** Timers. A Timer lives inside whatever owns it; fn gets the timer back and
+** finds its owner through arg. A zeroed Timer is simply not armed.
+*/
+
+typedef struct Timer Timer;
+
+struct Timer {
+  Timer *next;
+  Timer *prev;
+  uint64_t when;
+  void (*fn)(Timer *t);
+  void *arg;
+};
+
+extern int timer_fd;
+
+bool timer_init(void);
+bool timer_armed(Timer *t);
+void timer_arm(Timer *t, uint64_t ms);
+void timer_cancel(Timer *t);
+void timer_run(void);
+
+typedef struct {
+  double cpu_ms;
+  size_t mem_peak; // Bytes, and only when mem_known.
+  bool mem_known;
+} JobUsage;
+
+bool cgroup_init(void);
+int cgroup_job_open(unsigned long id);
+void cgroup_job_close(int dir, unsigned long id, JobUsage *use);
 
 void irc_send(int conn, const char *const fmt, ...);
-char irc_char(int conn);
+void irc_send_buf(int conn, TxtBuf *line);
+void irc_vec_init(IrcVec *v);
+void irc_vec_add(IrcVec *v, const char *s, size_t len);
+void irc_vec_cstr(IrcVec *v, const char *s);
+void irc_say(int conn, IrcVec *v);
+void irc_flood_init(void);
 void irc_line(int conn, TxtBuf *out);
 
+void irc_rx_init(IrcRx *rx);
+void irc_rx_feed(IrcRx *rx, const char *s, size_t len);
+bool irc_rx_line(IrcRx *rx, TxtBuf *line);
+
 void irc_nick_raw(TxtBuf *buf, TxtBuf *nick);
 void irc_msg_raw(TxtBuf *buf, TxtBuf *msg);
 
 enum server irc_info(TxtBuf *buf, TxtBuf *nick, TxtBuf *msg);
+enum cmd irc_dispatch(TxtBuf *nick, TxtBuf *msg);
+
+enum server sv_find(const char *name);
+bool bridge_add(const char *nick, enum server sv, const char *pattern);
+void bridge_load(const char *path);
+enum server bridge_match(PluginView nick, PluginView msg, PluginView *who, PluginView *text);
 
 void shell_esc(TxtBuf *dst, TxtBuf *src);
 
+typedef struct Plugin Plugin;
+
+bool plugin_load(const char *path);
+void plugin_load_dir(const char *dir);
+bool plugin_swap(const char *name);
+bool plugin_has(const char *cmd, size_t len);
+Plugin *plugin_acquire(const char *cmd, size_t len, PluginFn *fn);
+void plugin_release(Plugin *p);
+
+bool backend_init(void);
+bool backend_run(const char *origin, const char *nick, const char *cmd, const char *args, TxtBuf *out);
+
+void irc_stream_init(IrcStream *st, size_t cap);
+void irc_stream_begin(IrcStream *st, int conn, const char *to, const char *nick, const char *sep);
+void irc_stream_feed(IrcStream *st, const char *s, size_t len);
+void irc_stream_end(IrcStream *st);
+void irc_stream_more(IrcStream *st);
+void irc_stream_keep(IrcStream *dst, IrcStream *src);
+
 #endif // DIGIRC_H
@@ -0,0 +1,164 @@
+/*
+** io.c | Digi's IRC Bot | I/O engines.
+** https://github.com/davidgarland/digirc
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include "digirc.h"
+
+size_t io_syscalls;
+
+/*
+** Poll engine. This is the readiness-based fallback: one poll() covers every
+** watched descriptor, and the descriptors it reports ready are then read one
+** per io_wait call before polling again.
+*/
+
+#define POLL_BUF 4096
+
+static struct {
+  int fd;
+  enum io_kind kind;
+} poll_watch[IO_WATCH_MAX];
+static size_t poll_count;
+
+static struct pollfd poll_fds[IO_WATCH_MAX];
+static size_t poll_ready;
+static size_t poll_next;
+static char poll_buf[POLL_BUF];
+
+static bool poll_init(void) {
+  return true;
+}
+
+static void poll_add(int fd, enum io_kind kind) {
+  if (poll_count == IO_WATCH_MAX)
+    return;
+  poll_watch[poll_count].fd = fd;
+  poll_watch[poll_count].kind = kind;
+  poll_count++;
+  poll_ready = 0;
+}
+
+static void poll_remove(int fd) {
+  for (size_t i = 0; i < poll_count; i++) {
+    if (poll_watch[i].fd == fd) {
+      poll_watch[i] = poll_watch[--poll_count];
+      break;
+    }
+  }
+  poll_ready = 0;
+}
+
+static void poll_send(int fd, const struct iovec *iov, int n) {
+  struct iovec v[IO_IOV_MAX];
+  if (n > IO_IOV_MAX)
+    n = IO_IOV_MAX;
+  memcpy(v, iov, n * sizeof(*iov));
+  struct iovec *p = v;
+  while (n) {
+    ssize_t w = writev(fd, p, n);
+    io_syscalls++;
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    while (n && ((size_t) w >= p->iov_len)) {
+      w -= p->iov_len;
+      p++;
+      n--;
+    }
+    if (n) {
+      p->iov_base = (char *) p->iov_base + w;
+      p->iov_len -= w;
+    }
+  }
+}
+
+static bool poll_wait(IoEvent *ev) {
+  while (true) {
+    for (; poll_next < poll_ready; poll_next++) {
+      struct pollfd *pfd = &poll_fds[poll_next];
+      if (!pfd->revents)
+        continue;
+      poll_next++;
+      ssize_t n = read(pfd->fd, poll_buf, POLL_BUF);
+      io_syscalls++;
+      ev->fd = pfd->fd;
+      ev->len = n < 0 ? -errno : n;
+      ev->data = poll_buf;
+      ev->id = 0;
+      return true;
+    }
+
+    if (!poll_count)
+      return false;
+    for (size_t i = 0; i < poll_count; i++)
+      poll_fds[i] = (struct pollfd) {poll_watch[i].fd, POLLIN, 0};
+    int r = poll(poll_fds, poll_count, -1);
+    io_syscalls++;
+    if ((r < 0) && (errno != EINTR))
+      return false;
+    poll_ready = r > 0 ? poll_count : 0;
+    poll_next = 0;
+  }
+}
+
+static void poll_done(IoEvent *ev) {
+  (void) ev;
+}
+
+static const IoEngine io_poll_engine = {
+  "poll", poll_init, poll_add, poll_remove, poll_send, poll_wait, poll_done
+};
+
+/*
+** Engine selection
+*/
+
+static const IoEngine *io = &io_poll_engine;
+
+// DIGIRC_IO picks the engine; "uring" is the default where it is built in,
+// and anything that fails to set up falls back to poll.
+void io_init(void) {
+  const char *want = env_or("DIGIRC_IO", "uring");
+  const IoEngine *pick = &io_poll_engine;
+#ifdef DIGIRC_URING
+  if (!strcmp(want, "uring"))
+    pick = &io_uring_engine;
+#endif
+  if ((pick != &io_poll_engine) && !pick->init()) {
+    printf("[IOEN] %s unavailable, falling back to poll\n", pick->name);
+    pick = &io_poll_engine;
+  }
+  io = pick;
+  printf("[IOEN] Using %s\n", io->name);
+}
+
+const char *io_name(void) {
+  return io->name;
+}
+
+void io_watch(int fd, enum io_kind kind) {
+  io->watch(fd, kind);
+}
+
+void io_unwatch(int fd) {
+  io->unwatch(fd);
+}
+
+void io_send(int fd, const struct iovec *iov, int n) {
+  io->send(fd, iov, n);
+}
+
+bool io_wait(IoEvent *ev) {
+  return io->wait(ev);
+}
+
+void io_done(IoEvent *ev) {
+  io->done(ev);
+}
@@ -0,0 +1,419 @@
+/*
+** io_uring.c | Digi's IRC Bot | io_uring I/O engine.
+** https://github.com/davidgarland/digirc
+*/
+
+#include "digirc.h"
+
+#ifdef DIGIRC_URING
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+** Everything goes through one ring. The IRC socket gets a multishot recv and
+** pipes get a single-shot read that is re-armed after each completion; both
+** draw their buffers from one provided buffer ring, so nothing is allocated
+** per read. A reply goes out straight from the caller's segments when no send
+** is in flight. Only what the socket won't take at once is copied, or the
+** whole reply when it has to wait behind an earlier one. The copy is appended
+** to a write buffer and submitted as one send, alongside any re-arms, the
+** next time the bot waits for completions.
+**
+** Provided buffer rings arrived in 5.19 but multishot recv only in 6.0, so on
+** a kernel in between the first recv fails with EINVAL and the socket drops
+** to single-shot recvs, re-armed like the pipes.
+*/
+
+#define URING_ENTRIES 64
+#define URING_BUFS 64
+#define URING_BUF_SIZE 4096
+#define URING_BGID 0
+#define URING_QUEUE 256
+
+enum {
+  OP_RECV,
+  OP_READ,
+  OP_SEND,
+  OP_CANCEL
+};
+
+static int ring_fd = -1;
+
+static struct {
+  unsigned *head;
+  unsigned *tail;
+  unsigned *mask;
+  unsigned *array;
+  unsigned entries;
+  unsigned local_tail;
+  unsigned pending;
+  struct io_uring_sqe *sqes;
+} sq;
+
+static struct {
+  unsigned *head;
+  unsigned *tail;
+  unsigned *mask;
+  struct io_uring_cqe *cqes;
+} cq;
+
+static struct io_uring_buf_ring *br;
+static char *bufs;
+static unsigned br_tail;
+static bool recv_multishot = true;
+
+static struct {
+  int fd;
+  enum io_kind kind;
+  uint32_t gen;
+  bool used;
+  bool armed;
+  bool eof;
+} watch[IO_WATCH_MAX];
+
+// Two write buffers: cur is the one being sent, and while anything in it is
+// still unsent (in flight, or left over from a short send) new output
+// collects in the other, so lines always leave in the order they were sent.
+static struct {
+  TxtBuf buf[2];
+  size_t off;
+  int fd;
+  int cur;
+  bool busy;
+} out;
+
+static IoEvent queue[URING_QUEUE];
+static size_t queue_head;
+static size_t queue_len;
+
+static uint64_t uring_tag(uint32_t gen, size_t slot, int op) {
+  return ((uint64_t) gen << 32) | (slot << 8) | op;
+}
+
+static int uring_enter(unsigned submit, unsigned wait) {
+  int r = syscall(__NR_io_uring_enter, ring_fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  io_syscalls++;
+  if (r > 0)
+    sq.pending -= r;
+  return r;
+}
+
+static struct io_uring_sqe *uring_sqe(void) {
+  if (sq.local_tail - __atomic_load_n(sq.head, __ATOMIC_ACQUIRE) >= sq.entries)
+    uring_enter(sq.pending, 0);
+  unsigned idx = sq.local_tail & *sq.mask;
+  struct io_uring_sqe *sqe = &sq.sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sq.array[idx] = idx;
+  sq.local_tail++;
+  sq.pending++;
+  __atomic_store_n(sq.tail, sq.local_tail, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+static void uring_buf_add(unsigned bid) {
+  struct io_uring_buf *b = &br->bufs[br_tail & (URING_BUFS - 1)];
+  b->addr = (uintptr_t) (bufs + (size_t) bid * URING_BUF_SIZE);
+  b->len = URING_BUF_SIZE;
+  b->bid = bid;
+  br_tail++;
+  __atomic_store_n(&br->tail, br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_arm(size_t slot) {
+  struct io_uring_sqe *sqe = uring_sqe();
+  sqe->fd = watch[slot].fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  if (watch[slot].kind == IO_SOCKET) {
+    sqe->opcode = IORING_OP_RECV;
+    if (recv_multishot)
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+    else
+      sqe->len = URING_BUF_SIZE;
+    sqe->user_data = uring_tag(watch[slot].gen, slot, OP_RECV);
+  } else {
+    sqe->opcode = IORING_OP_READ;
+    sqe->off = (uint64_t) -1;
+    sqe->len = URING_BUF_SIZE;
+    sqe->user_data = uring_tag(watch[slot].gen, slot, OP_READ);
+  }
+  watch[slot].armed = true;
+}
+
+static void uring_send_kick(void) {
+  if (out.busy || !out.buf[out.cur].len)
+    return;
+  TxtBuf *b = &out.buf[out.cur];
+  struct io_uring_sqe *sqe = uring_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = out.fd;
+  sqe->addr = (uintptr_t) (b->data + out.off);
+  sqe->len = b->len - out.off;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = uring_tag(0, out.cur, OP_SEND);
+  out.busy = true;
+}
+
+static void uring_push(int fd, ssize_t len, char *data, unsigned id) {
+  if (queue_len == URING_QUEUE)
+    return;
+  queue[(queue_head + queue_len++) % URING_QUEUE] = (IoEvent) {fd, len, data, id};
+}
+
+static void uring_complete(struct io_uring_cqe *cqe) {
+  int op = cqe->user_data & 0xFF;
+  size_t slot = (cqe->user_data >> 8) & 0xFFFFFF;
+  uint32_t gen = cqe->user_data >> 32;
+  bool has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+  unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if (op == OP_CANCEL)
+    return;
+
+  if (op == OP_SEND) {
+    TxtBuf *b = &out.buf[slot];
+    out.busy = false;
+    if (cqe->res < 0) {
+      printf("[IOEN] send failed: %s\n", strerror(-cqe->res));
+      out.off = b->len;
+    } else {
+      out.off += cqe->res;
+    }
+    if (out.off >= b->len) {
+      txtbuf_clear(b);
+      out.off = 0;
+      out.cur ^= 1;
+    }
+    return;
+  }
+
+  if (!watch[slot].used || (watch[slot].gen != gen)) {
+    if (has_buf)
+      uring_buf_add(bid);
+    return;
+  }
+
+  if ((op == OP_READ) || !recv_multishot || !(cqe->flags & IORING_CQE_F_MORE))
+    watch[slot].armed = false;
+  // A read that hits EOF can still have picked a buffer; hand it straight back.
+  if (has_buf && (cqe->res <= 0)) {
+    uring_buf_add(bid);
+    has_buf = false;
+  }
+  if ((cqe->res == -EINVAL) && (op == OP_RECV) && recv_multishot) {
+    printf("[IOEN] Multishot recv unsupported, using single-shot recvs\n");
+    recv_multishot = false;
+    return;
+  }
+  // These only mean the op has to be armed again, which the next wait does.
+  if ((cqe->res == -ENOBUFS) || (cqe->res == -EINTR) || (cqe->res == -EAGAIN))
+    return;
+  if (cqe->res < 0)
+    printf("[IOEN] %s on fd %d failed: %s\n", op == OP_RECV ? "recv" : "read", watch[slot].fd, strerror(-cqe->res));
+  if (cqe->res <= 0)
+    watch[slot].eof = true;
+  if (has_buf)
+    uring_push(watch[slot].fd, cqe->res, bufs + (size_t) bid * URING_BUF_SIZE, bid);
+  else
+    uring_push(watch[slot].fd, cqe->res, NULL, 0);
+}
+
+static size_t uring_reap(void) {
+  unsigned head = *cq.head;
+  unsigned tail = __atomic_load_n(cq.tail, __ATOMIC_ACQUIRE);
+  size_t n = 0;
+  for (; head != tail; head++, n++)
+    uring_complete(&cq.cqes[head & *cq.mask]);
+  __atomic_store_n(cq.head, head, __ATOMIC_RELEASE);
+  return n;
+}
+
+static bool uring_init(void) {
+  if (ring_fd >= 0)
+    return true;
+
+  struct io_uring_params p = {0};
+  int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  io_syscalls++;
+  if (fd < 0)
+    return false;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(fd);
+    return false;
+  }
+
+  char *ring = MAP_FAILED;
+  struct io_uring_sqe *sqes = MAP_FAILED;
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  size_t size = sq_size > cq_size ? sq_size : cq_size;
+  size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  size_t br_size = URING_BUFS * sizeof(struct io_uring_buf);
+  ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  br = mmap(NULL, br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ((ring == MAP_FAILED) || (sqes == MAP_FAILED) || (br == MAP_FAILED))
+    goto fail;
+  struct io_uring_buf_reg reg = {
+    .ring_addr = (uintptr_t) br,
+    .ring_entries = URING_BUFS,
+    .bgid = URING_BGID
+  };
+  io_syscalls++;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+    goto fail;
+
+  sq.head = (unsigned *) (ring + p.sq_off.head);
+  sq.tail = (unsigned *) (ring + p.sq_off.tail);
+  sq.mask = (unsigned *) (ring + p.sq_off.ring_mask);
+  sq.array = (unsigned *) (ring + p.sq_off.array);
+  sq.entries = p.sq_entries;
+  sq.local_tail = *sq.tail;
+  sq.sqes = sqes;
+  cq.head = (unsigned *) (ring + p.cq_off.head);
+  cq.tail = (unsigned *) (ring + p.cq_off.tail);
+  cq.mask = (unsigned *) (ring + p.cq_off.ring_mask);
+  cq.cqes = (struct io_uring_cqe *) (ring + p.cq_off.cqes);
+  ring_fd = fd;
+
+  bufs = malloc((size_t) URING_BUFS * URING_BUF_SIZE);
+  for (unsigned i = 0; i < URING_BUFS; i++)
+    uring_buf_add(i);
+
+  for (int i = 0; i < 2; i++) {
+    out.buf[i] = txtbuf_init();
+    txtbuf_alloc(&out.buf[i], 4096);
+  }
+  out.fd = -1;
+  return true;
+
+fail:
+  if (ring != MAP_FAILED)
+    munmap(ring, size);
+  if (sqes != MAP_FAILED)
+    munmap(sqes, sqes_size);
+  if (br != MAP_FAILED)
+    munmap(br, br_size);
+  br = NULL;
+  close(fd);
+  return false;
+}
+
+static void uring_watch(int fd, enum io_kind kind) {
+  for (size_t i = 0; i < IO_WATCH_MAX; i++) {
+    if (watch[i].used)
+      continue;
+    watch[i].fd = fd;
+    watch[i].kind = kind;
+    watch[i].used = true;
+    watch[i].armed = false;
+    watch[i].eof = false;
+    uring_arm(i);
+    return;
+  }
+}
+
+static void uring_unwatch(int fd) {
+  for (size_t i = 0; i < IO_WATCH_MAX; i++) {
+    if (!watch[i].used || (watch[i].fd != fd))
+      continue;
+    if (watch[i].armed) {
+      struct io_uring_sqe *sqe = uring_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = uring_tag(watch[i].gen, i, watch[i].kind == IO_SOCKET ? OP_RECV : OP_READ);
+      sqe->user_data = uring_tag(0, 0, OP_CANCEL);
+    }
+    watch[i].used = false;
+    watch[i].gen++;
+  }
+
+  // Drop anything already queued for it; those buffers go straight back.
+  for (size_t i = 0; i < queue_len; i++) {
+    IoEvent *ev = &queue[(queue_head + i) % URING_QUEUE];
+    if (ev->fd != fd)
+      continue;
+    if (ev->data)
+      uring_buf_add(ev->id);
+    ev->fd = -1;
+  }
+}
+
+static void uring_send(int fd, const struct iovec *iov, int n) {
+  if ((out.fd >= 0) && (out.fd != fd)) {
+    // Only the IRC socket is written through the ring.
+    for (int i = 0; i < n; i++) {
+      write(fd, iov[i].iov_base, iov[i].iov_len);
+      io_syscalls++;
+    }
+    return;
+  }
+  out.fd = fd;
+  bool pending = out.busy || (out.off < out.buf[out.cur].len);
+  size_t sent = 0;
+  if (!pending) {
+    struct msghdr mh = {.msg_iov = (struct iovec *) iov, .msg_iovlen = n};
+    ssize_t w = sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+    io_syscalls++;
+    if (w > 0)
+      sent = w;
+  }
+  TxtBuf *b = &out.buf[pending ? out.cur ^ 1 : out.cur];
+  for (int i = 0; i < n; i++) {
+    if (sent >= iov[i].iov_len) {
+      sent -= iov[i].iov_len;
+      continue;
+    }
+    txtbuf_cat_mem(b, (char *) iov[i].iov_base + sent, iov[i].iov_len - sent);
+    sent = 0;
+  }
+}
+
+static bool uring_wait(IoEvent *ev) {
+  while (true) {
+    while (queue_len) {
+      *ev = queue[queue_head];
+      queue_head = (queue_head + 1) % URING_QUEUE;
+      queue_len--;
+      if (ev->fd >= 0)
+        return true;
+    }
+
+    bool live = out.busy || out.buf[0].len || out.buf[1].len;
+    for (size_t i = 0; i < IO_WATCH_MAX; i++) {
+      if (!watch[i].used || watch[i].eof)
+        continue;
+      live = true;
+      if (!watch[i].armed)
+        uring_arm(i);
+    }
+    if (!live)
+      return false;
+
+    uring_send_kick();
+    if (!uring_reap()) {
+      if ((uring_enter(sq.pending, 1) < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+        return false;
+      uring_reap();
+    }
+  }
+}
+
+static void uring_done(IoEvent *ev) {
+  if (ev->data)
+    uring_buf_add(ev->id);
+}
+
+const IoEngine io_uring_engine = {
+  "uring", uring_init, uring_watch, uring_unwatch, uring_send, uring_wait, uring_done
+};
+
+#endif // DIGIRC_URING
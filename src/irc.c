@@ -5,6 +5,7 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <stdlib.h>
 #include "digirc.h"
 
 char *sv_name[SV_LENGTH] = {
@@ -14,108 +15,271 @@ char *sv_name[SV_LENGTH] = {
   [SV_NETWORK] = "Network"
 };
 
+IrcRx irc_rx;
+
+// Settings that differ between the real server and a local test setup come
+// from the environment, falling back to the production values.
+const char *env_or(const char *name, const char *fallback) {
+  const char *v = getenv(name);
+  return (v && *v) ? v : fallback;
+}
+
+// Overlong lines are cut on a character boundary and keep their CRLF.
+static size_t irc_cut(char *buf, size_t len) {
+  if (len > IRC_MSG_MAX) {
+    len = txtbuf_utf8_cut(buf, IRC_MSG_MAX, IRC_MSG_MAX - 2);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    buf[len] = '\0';
+  }
+  return len;
+}
+
+static void irc_send_raw(int conn, const char *buf, size_t len) {
+  printf("[SEND] %.*s", (int) len, buf);
+  io_send(conn, &(struct iovec) {(char *) buf, len}, 1);
+}
+
 void irc_send(int conn, const char *const fmt, ...) {
-  static char buf[512];
+  static char buf[IRC_MSG_MAX + 1];
   va_list ap;
   va_start(ap, fmt);
-  register const uint16_t len = vsnprintf(buf, 512, fmt, ap);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
   va_end(ap);
-  printf("[SEND] %s", buf);
-  write(conn, buf, len);
+  if (len >= 0)
+    irc_send_raw(conn, buf, irc_cut(buf, len));
+}
+
+// Sends a line that was built up with the typed txtbuf appends, CRLF included.
+void irc_send_buf(int conn, TxtBuf *line) {
+  line->len = irc_cut(line->data, line->len);
+  irc_send_raw(conn, line->data, line->len);
 }
 
-char irc_char(int conn) {
-  char c;
-  uint16_t bytes = read(conn, &c, 1);
-  return c;
+/*
+** Reply lines. A reply is assembled as a short list of segments that point at
+** the buffers the pieces already live in (the command prefix, the nick, the
+** child's output) and is handed to the I/O engine as one writev (one sendmsg
+** under io_uring), so the payload isn't copied on its way out. The io_uring
+** engine copies only what the socket doesn't take at once, or the whole line
+** when an earlier send is still in flight. The 512 byte limit is counted over
+** the segments: the one that crosses it is cut on a character boundary and
+** anything after it is dropped.
+*/
 
-  /*
-  static char buf[512] = {0};
-  static uint16_t bytes = 0;
-  static uint16_t bytes_left = 0;
+void irc_vec_init(IrcVec *v) {
+  v->n = 0;
+  v->len = 0;
+}
 
-  if (!bytes_left) {
-    bytes = 0;
-    while (!bytes)
-      bytes = read(conn, buf, 512);
-    bytes_left = bytes;
+// The last slot is kept for irc_say's CRLF. Segments past that can't be
+// joined onto the others without a copy, so they are dropped, loudly.
+void irc_vec_add(IrcVec *v, const char *s, size_t len) {
+  if (!len)
+    return;
+  if (v->n == IRC_VEC_MAX - 1) {
+    printf("[SEND] Reply needs more than %d segments, dropping %zu bytes\n", IRC_VEC_MAX - 1, len);
+    return;
   }
+  v->seg[v->n++] = (struct iovec) {(char *) s, len};
+  v->len += len;
+}
 
-  return buf[bytes - bytes_left--];
-  */
+void irc_vec_cstr(IrcVec *v, const char *s) {
+  irc_vec_add(v, s, strlen(s));
 }
 
-void irc_line(int conn, TxtBuf *buf) {
-  txtbuf_clear(buf);
+static void irc_vec_fit(IrcVec *v) {
+  size_t room = IRC_MSG_MAX - 2;
+  if (v->len <= room)
+    return;
+  int i = 0;
+  while (v->seg[i].iov_len <= room)
+    room -= v->seg[i++].iov_len;
+  v->seg[i].iov_len = txtbuf_utf8_cut(v->seg[i].iov_base, v->seg[i].iov_len, room);
+  v->len = IRC_MSG_MAX - 2 - room + v->seg[i].iov_len;
+  // A cut that lands on a segment boundary leaves nothing of that segment.
+  v->n = v->seg[i].iov_len ? i + 1 : i;
+}
+
+static void irc_vec_write(int conn, IrcVec *v) {
+  fputs("[SEND] ", stdout);
+  for (int i = 0; i < v->n; i++)
+    fwrite(v->seg[i].iov_base, 1, v->seg[i].iov_len, stdout);
+  io_send(conn, v->seg, v->n);
+}
+
+/*
+** Flood control. Servers drop clients that talk too fast, so replies draw on
+** a token bucket: a burst of lines goes out at once, and after that one line
+** per refill. Lines that find the bucket empty are copied into a queue to
+** wait their turn, which is the only time a reply's payload gets copied.
+** The refill timer only runs while the bucket is short, so a quiet bot has
+** nothing ticking. Protocol traffic (PONGs, registration) skips the bucket.
+*/
+
+#define FLOOD_QUEUE_MAX 16384
+
+static size_t flood_burst;
+static size_t flood_tokens;
+static uint64_t flood_ms;
+static int flood_conn;
+static TxtBuf flood_queue;
+static Timer flood_timer;
+
+static void flood_refill(Timer *t) {
+  if (flood_tokens < flood_burst)
+    flood_tokens++;
+  size_t off = 0;
+  while (flood_tokens && (off < flood_queue.len)) {
+    char *nl = memchr(flood_queue.data + off, '\n', flood_queue.len - off);
+    size_t n = nl - (flood_queue.data + off) + 1;
+    irc_send_raw(flood_conn, flood_queue.data + off, n);
+    off += n;
+    flood_tokens--;
+  }
+  memmove(flood_queue.data, flood_queue.data + off, flood_queue.len - off + 1);
+  flood_queue.len -= off;
+  if ((flood_tokens < flood_burst) || flood_queue.len)
+    timer_arm(t, flood_ms);
+}
 
-  bool last_r = false;
+// DIGIRC_FLOOD_BURST lines go out at once and one more every DIGIRC_FLOOD_MS;
+// a burst of 0 turns flood control off.
+void irc_flood_init(void) {
+  flood_burst = strtoul(env_or("DIGIRC_FLOOD_BURST", "10"), NULL, 10);
+  flood_ms = strtoul(env_or("DIGIRC_FLOOD_MS", "500"), NULL, 10);
+  flood_tokens = flood_burst;
+  flood_timer.fn = flood_refill;
+  flood_queue = txtbuf_init();
+  txtbuf_alloc(&flood_queue, 1024);
+}
+
+// Sends a reply built up in v, adding the CRLF itself.
+void irc_say(int conn, IrcVec *v) {
+  irc_vec_fit(v);
+  v->seg[v->n++] = (struct iovec) {"\r\n", 2};
+  v->len += 2;
+  if (!flood_burst) {
+    irc_vec_write(conn, v);
+    return;
+  }
 
-  while (true) {
-    char c = irc_char(conn);
-    txtbuf_push(buf, c);
-    if (last_r && (c == '\n'))
-      return;
-    last_r = c == '\r';
+  flood_conn = conn;
+  if (flood_tokens && !flood_queue.len) {
+    flood_tokens--;
+    irc_vec_write(conn, v);
+  } else if (flood_queue.len + v->len <= FLOOD_QUEUE_MAX) {
+    for (int i = 0; i < v->n; i++)
+      txtbuf_cat_mem(&flood_queue, v->seg[i].iov_base, v->seg[i].iov_len);
+  } else {
+    printf("[FLOD] Queue full, dropped a %zu byte line\n", v->len);
   }
+  if (!timer_armed(&flood_timer))
+    timer_arm(&flood_timer, flood_ms);
 }
 
-void irc_nick_data(TxtBuf *buf, TxtBuf *nick) {
-  txtbuf_clear(nick);
+void irc_rx_init(IrcRx *rx) {
+  rx->buf = txtbuf_init();
+  txtbuf_alloc(&rx->buf, 4096);
+  rx->off = 0;
+}
 
-  for (size_t i = 1, j = 0; (i < (buf->len - 2)) && (buf->data[i] != '!'); i++, j++)
-    txtbuf_push(nick, buf->data[i]);
+void irc_rx_feed(IrcRx *rx, const char *s, size_t len) {
+  txtbuf_cat_mem(&rx->buf, s, len);
 }
 
-void irc_msg_data(TxtBuf *buf, TxtBuf *msg) {
-  txtbuf_clear(msg);
+// Pops the next complete line, CRLF included, off the receive buffer.
+bool irc_rx_line(IrcRx *rx, TxtBuf *line) {
+  size_t i;
+  txtbuf_find_cstr(&rx->buf, rx->off, "\r\n", &i);
+  if (i >= rx->buf.len) {
+    memmove(rx->buf.data, rx->buf.data + rx->off, rx->buf.len - rx->off + 1);
+    rx->buf.len -= rx->off;
+    rx->off = 0;
+    return false;
+  }
+  txtbuf_cpy_slice(line, &rx->buf, (Slice) {rx->off, i + 1});
+  rx->off = i + 2;
+  return true;
+}
 
-  size_t i, j;
-  
-  for (i = 0, j = 0; (i < (buf->len - 2)) && (j < 3); i++)
-    if (buf->data[i] == ' ')
-      j++;
-  i++;
-  
-  for (j = 0; i < (buf->len - 2); i++, j++)
-    txtbuf_push(msg, buf->data[i]);
+// Blocks until a whole line has arrived. This is only for registration; once
+// children are running, the main loop has to see every event itself.
+void irc_line(int conn, TxtBuf *buf) {
+  while (!irc_rx_line(&irc_rx, buf)) {
+    IoEvent ev;
+    if (!io_wait(&ev) || ((ev.fd == conn) && (ev.len <= 0))) {
+      printf("[DISC] Connection closed\n");
+      exit(EXIT_FAILURE);
+    }
+    if (ev.fd == conn)
+      irc_rx_feed(&irc_rx, ev.data, ev.len);
+    io_done(&ev);
+    if (ev.fd == timer_fd)
+      timer_run();
+  }
 }
 
-enum server irc_info(TxtBuf *buf, TxtBuf *nick, TxtBuf *msg) {
-  irc_nick_data(buf, nick);
-  irc_msg_data(buf, msg);
-
-  enum server sv = SV_IRC;
-  if (!strncmp(nick->data, "ORENetwork", 10))
-    sv = SV_NETWORK;
-  else if (!strncmp(nick->data, "OREDiscord", 10))
-    sv = SV_DISCORD;
-
-  if (sv != SV_IRC) {
-    uint16_t i, j, k;
-    for (i = 0; (i < msg->len) && (msg->data[i] != ':'); i++);
-    for (j = 0; j < (i - 4); j++)
-      txtbuf_set(nick, j, msg->data[j + 3]);
-    txtbuf_set(nick, j, '\0');
-    for (j = i + 2, k = 0; j < msg->len; j++, k++)
-      txtbuf_set(msg, k, msg->data[j]);
-    txtbuf_set(msg, k, '\0');
+// The sender's nick and the message text, pointing into the line itself.
+static PluginView irc_nick_view(TxtBuf *buf) {
+  size_t end = buf->len - 2, i;
+  txtbuf_find(buf, 1, '!', &i);
+  if (i > end)
+    i = end;
+  return (PluginView) {buf->data + 1, i > 1 ? i - 1 : 0};
+}
+
+static PluginView irc_msg_view(TxtBuf *buf) {
+  size_t end = buf->len - 2, i = 0;
+
+  for (int j = 0; (j < 3) && (i < end); j++) {
+    txtbuf_find(buf, i, ' ', &i);
+    i++;
   }
+  i++;
+
+  return (PluginView) {buf->data + i, i < end ? end - i : 0};
+}
+
+static void irc_view_cpy(TxtBuf *dst, PluginView v) {
+  txtbuf_clear(dst);
+  txtbuf_cat_mem(dst, v.data, v.len);
+}
 
+// Relayed lines are picked apart inside buf, so nick and msg are each copied
+// out once, straight from the line, whether or not a relay sent it.
+enum server irc_info(TxtBuf *buf, TxtBuf *nick, TxtBuf *msg) {
+  PluginView who, text;
+  enum server sv = bridge_match(irc_nick_view(buf), irc_msg_view(buf), &who, &text);
+  irc_view_cpy(nick, who);
+  irc_view_cpy(msg, text);
   return sv;
 }
 
+enum cmd irc_dispatch(TxtBuf *nick, TxtBuf *msg) {
+  if (!msg->len || (msg->data[0] != '.'))
+    return CMD_NONE;
+  if (!strncmp(msg->data, ".reload", 7) && !strncmp(nick->data, "Digi", 4))
+    return CMD_RELOAD;
+  if (!strcmp(msg->data, ".more"))
+    return CMD_MORE;
+  if (!strncmp(msg->data, ".swap ", 6) && !strncmp(nick->data, "Digi", 4))
+    return CMD_SWAP;
+  if (!strncmp(msg->data, ".eval", 5) && (msg->len > 6))
+    return CMD_EVAL;
+  if (!strncmp(msg->data, ".type", 5) && (msg->len > 6))
+    return CMD_TYPE;
+  size_t sp;
+  txtbuf_find(msg, 0, ' ', &sp);
+  if (plugin_has(msg->data, sp))
+    return CMD_PLUGIN;
+  return CMD_BACKEND;
+}
+
 void shell_esc(TxtBuf *dst, TxtBuf *src) {
   txtbuf_clear(dst);
   txtbuf_push(dst, '\'');
-  for (size_t i = 0; i < src->len; i++) {
-    char c = src->data[i];
-    printf("%c", c);
-    if (c == '\'') {
-      txtbuf_cat_cstr(dst, "\'\"\'\"\'");
-    } else {
-      txtbuf_push(dst, c);
-    }
-  }
+  txtbuf_cat_escape(dst, src, '\'', "\'\"\'\"\'");
   txtbuf_push(dst, '\'');
 }
-
@@ -0,0 +1,191 @@
+/*
+** plugin.c | Digi's IRC Bot | Command plugins.
+** https://github.com/davidgarland/digirc
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include "digirc.h"
+
+/*
+** Every loaded copy of a module gets a slot. Swapping a module loads the new
+** copy into a fresh slot and retires the old one: a retired copy no longer
+** answers lookups, but it stays mapped until the last call holding a
+** reference to it has returned, so a swap asked for from inside a handler
+** never pulls code out from under it.
+*/
+
+#define PLUGIN_MAX 16
+
+struct Plugin {
+  bool used;
+  bool live;
+  size_t refs;
+  void *dl;
+  const PluginInfo *info;
+  char *path;
+};
+
+static Plugin plugin_tab[PLUGIN_MAX];
+
+// dlopen hands back the already-loaded copy for a path it has seen, so each
+// load goes through a private copy of the file. The copy is unlinked as soon
+// as it is mapped.
+static void *plugin_open(const char *path) {
+  int in = open(path, O_RDONLY);
+  if (in < 0)
+    return NULL;
+  const char *tmp = env_or("TMPDIR", "/tmp");
+  char copy[256];
+  snprintf(copy, sizeof(copy), "%s/digirc-plugin-XXXXXX", tmp);
+  int out = mkstemp(copy);
+  if (out < 0) {
+    close(in);
+    return NULL;
+  }
+
+  char buf[8192];
+  ssize_t n;
+  bool ok = true;
+  while (ok && ((n = read(in, buf, sizeof(buf))) > 0))
+    ok = write(out, buf, n) == n;
+  close(in);
+  close(out);
+
+  void *dl = (ok && (n == 0)) ? dlopen(copy, RTLD_NOW | RTLD_LOCAL) : NULL;
+  if (!dl && ok)
+    printf("[PLUG] %s\n", dlerror());
+  unlink(copy);
+  return dl;
+}
+
+static Plugin *plugin_named(const char *name) {
+  for (size_t i = 0; i < PLUGIN_MAX; i++)
+    if (plugin_tab[i].live && !strcmp(plugin_tab[i].info->name, name))
+      return &plugin_tab[i];
+  return NULL;
+}
+
+static Plugin *plugin_open_slot(const char *path) {
+  Plugin *p = NULL;
+  for (size_t i = 0; (i < PLUGIN_MAX) && !p; i++)
+    if (!plugin_tab[i].used)
+      p = &plugin_tab[i];
+  if (!p) {
+    printf("[PLUG] No room for %s\n", path);
+    return NULL;
+  }
+
+  void *dl = plugin_open(path);
+  if (!dl) {
+    printf("[PLUG] Couldn't load %s\n", path);
+    return NULL;
+  }
+  const PluginInfo *info = dlsym(dl, DIGIRC_PLUGIN_SYM);
+  if (!info || (info->abi != DIGIRC_PLUGIN_ABI) || !info->name || !info->cmds) {
+    printf("[PLUG] %s is not a digirc plugin (ABI %u)\n", path, DIGIRC_PLUGIN_ABI);
+    dlclose(dl);
+    return NULL;
+  }
+
+  p->used = true;
+  p->live = true;
+  p->refs = 0;
+  p->dl = dl;
+  p->info = info;
+  p->path = strdup(path);
+  size_t n = 0;
+  while (info->cmds[n].name)
+    n++;
+  printf("[PLUG] Loaded %s (%zu commands) from %s\n", info->name, n, path);
+  return p;
+}
+
+static void plugin_unload(Plugin *p) {
+  dlclose(p->dl);
+  free(p->path);
+  *p = (Plugin) {0};
+}
+
+bool plugin_load(const char *path) {
+  Plugin *p = plugin_open_slot(path);
+  if (!p)
+    return false;
+  for (size_t i = 0; i < PLUGIN_MAX; i++) {
+    Plugin *q = &plugin_tab[i];
+    if ((q != p) && q->live && !strcmp(q->info->name, p->info->name)) {
+      printf("[PLUG] %s is already loaded\n", p->info->name);
+      p->live = false;
+      plugin_unload(p);
+      return false;
+    }
+  }
+  return true;
+}
+
+void plugin_load_dir(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent *e;
+  char path[512];
+  while ((e = readdir(d))) {
+    size_t len = strlen(e->d_name);
+    if ((len < 4) || strcmp(e->d_name + len - 3, ".so"))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    plugin_load(path);
+  }
+  closedir(d);
+}
+
+bool plugin_swap(const char *name) {
+  Plugin *old = plugin_named(name);
+  if (!old)
+    return false;
+  Plugin *p = plugin_open_slot(old->path);
+  if (!p)
+    return false;
+  old->live = false;
+  printf("[PLUG] Swapped %s, %zu calls still on the old copy\n", name, old->refs);
+  if (!old->refs)
+    plugin_unload(old);
+  return true;
+}
+
+static const PluginCmd *plugin_cmd(Plugin *p, const char *cmd, size_t len) {
+  for (const PluginCmd *c = p->info->cmds; c->name; c++)
+    if (!strncmp(c->name, cmd, len) && !c->name[len])
+      return c;
+  return NULL;
+}
+
+bool plugin_has(const char *cmd, size_t len) {
+  for (size_t i = 0; i < PLUGIN_MAX; i++)
+    if (plugin_tab[i].live && plugin_cmd(&plugin_tab[i], cmd, len))
+      return true;
+  return false;
+}
+
+Plugin *plugin_acquire(const char *cmd, size_t len, PluginFn *fn) {
+  for (size_t i = 0; i < PLUGIN_MAX; i++) {
+    Plugin *p = &plugin_tab[i];
+    const PluginCmd *c;
+    if (!p->live || !(c = plugin_cmd(p, cmd, len)))
+      continue;
+    p->refs++;
+    *fn = c->fn;
+    return p;
+  }
+  return NULL;
+}
+
+void plugin_release(Plugin *p) {
+  if (!--p->refs && !p->live) {
+    printf("[PLUG] Last call on the old %s returned\n", p->info->name);
+    plugin_unload(p);
+  }
+}
@@ -0,0 +1,60 @@
+/*
+** plugin.h | Digi's IRC Bot | Plugin ABI
+** https://github.com/davidgarland/digirc
+*/
+
+#ifndef DIGIRC_PLUGIN_H
+#define DIGIRC_PLUGIN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <circa_txtbuf.h>
+
+/*
+** This is everything a plugin sees of the bot. A plugin is a shared object
+** that exports one PluginInfo named "digirc_plugin"; the bot refuses any whose
+** abi field doesn't match DIGIRC_PLUGIN_ABI, so anything here that changes
+** layout has to bump it. New fields only ever go on the end of PluginCall.
+*/
+
+#define DIGIRC_PLUGIN_ABI 1
+#define DIGIRC_PLUGIN_SYM "digirc_plugin"
+
+enum server {
+  SV_NONE,
+  SV_IRC,
+  SV_DISCORD,
+  SV_NETWORK,
+  SV_LENGTH
+};
+
+// Points into the bot's own buffers; only valid for the length of the call.
+typedef struct {
+  const char *data;
+  size_t len;
+} PluginView;
+
+typedef struct {
+  enum server origin;
+  PluginView nick;
+  PluginView cmd;  // The command word, including the leading '.'.
+  PluginView args; // Everything after the command word and one space.
+} PluginCall;
+
+// Handlers append their reply to out, which arrives empty; leaving it empty
+// sends nothing. Returning false makes the bot answer "Error" instead.
+typedef bool (*PluginFn)(const PluginCall *call, TxtBuf *out);
+
+typedef struct {
+  const char *name; // e.g. ".ping"
+  PluginFn fn;
+} PluginCmd;
+
+typedef struct {
+  unsigned abi;
+  const char *name;
+  const PluginCmd *cmds; // Terminated by an entry with a NULL name.
+} PluginInfo;
+
+#endif // DIGIRC_PLUGIN_H
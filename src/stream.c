@@ -0,0 +1,154 @@
+/*
+** stream.c | Digi's IRC Bot | Paginated output streams.
+** https://github.com/davidgarland/digirc
+*/
+
+#include <string.h>
+#include "digirc.h"
+
+// A prefix is cut to half a message, so every page has room for some text.
+#define IRC_PREFIX_MAX (IRC_MSG_MAX / 2)
+
+void irc_stream_init(IrcStream *st, size_t cap) {
+  st->prefix = txtbuf_init();
+  st->line = txtbuf_init();
+  st->more = txtbuf_init();
+  txtbuf_alloc(&st->prefix, 64);
+  txtbuf_alloc(&st->line, IRC_MSG_MAX);
+  txtbuf_alloc(&st->more, 1);
+  st->conn = -1;
+  st->sent = 0;
+  st->cap = cap;
+  st->full = false;
+}
+
+// Every page starts "PRIVMSG <to> :<nick><sep>".
+void irc_stream_begin(IrcStream *st, int conn, const char *to, const char *nick, const char *sep) {
+  txtbuf_cpy_cstr(&st->prefix, "PRIVMSG ");
+  txtbuf_cat_cstr(&st->prefix, (char *) to);
+  txtbuf_cat_cstr(&st->prefix, " :");
+  txtbuf_cat_cstr(&st->prefix, (char *) nick);
+  txtbuf_cat_cstr(&st->prefix, (char *) sep);
+  st->prefix.len = txtbuf_utf8_cut(st->prefix.data, st->prefix.len, IRC_PREFIX_MAX);
+  st->prefix.data[st->prefix.len] = '\0';
+  txtbuf_clear(&st->line);
+  txtbuf_clear(&st->more);
+  st->conn = conn;
+  st->sent = 0;
+  st->full = false;
+}
+
+static void irc_stream_send(IrcStream *st, const char *s, size_t len) {
+  IrcVec v;
+  irc_vec_init(&v);
+  irc_vec_add(&v, st->prefix.data, st->prefix.len);
+  irc_vec_add(&v, s, len);
+  irc_say(st->conn, &v);
+}
+
+static size_t irc_stream_room(IrcStream *st) {
+  return IRC_MSG_MAX - 2 - st->prefix.len;
+}
+
+// Lines past the cap are held for ".more", up to IRC_MORE_MAX bytes. Past
+// that the stream is full: the rest is dropped, and the held lines end by
+// saying so.
+static void irc_stream_page(IrcStream *st, const char *s, size_t len) {
+  static const char cut[] = "(output truncated)\n";
+  if (!len || st->full)
+    return;
+  if (st->sent < st->cap) {
+    irc_stream_send(st, s, len);
+    st->sent++;
+  } else if (st->more.len + len + 1 > IRC_MORE_MAX) {
+    txtbuf_cat_mem(&st->more, cut, sizeof(cut) - 1);
+    st->full = true;
+  } else {
+    txtbuf_cat_mem(&st->more, s, len);
+    txtbuf_push(&st->more, '\n');
+  }
+}
+
+static void irc_stream_line(IrcStream *st, const char *s, size_t len) {
+  if (len && (s[len - 1] == '\r'))
+    len--;
+  size_t room = irc_stream_room(st);
+  while (len) {
+    size_t n = txtbuf_utf8_cut(s, len, room);
+    irc_stream_page(st, s, n);
+    s += n;
+    len -= n;
+  }
+}
+
+static void irc_stream_drop(IrcStream *st, size_t n) {
+  memmove(st->line.data, st->line.data + n, st->line.len - n + 1);
+  st->line.len -= n;
+}
+
+static void irc_stream_drain(IrcStream *st) {
+  char *nl;
+  while ((nl = memchr(st->line.data, '\n', st->line.len))) {
+    size_t n = nl - st->line.data;
+    irc_stream_line(st, st->line.data, n);
+    irc_stream_drop(st, n + 1);
+  }
+
+  // A partial line that already fills a message goes out now rather than
+  // waiting for the newline; the tail stays behind for the next chunk.
+  size_t room = irc_stream_room(st);
+  while (st->line.len > room) {
+    size_t n = txtbuf_utf8_cut(st->line.data, st->line.len, room);
+    irc_stream_page(st, st->line.data, n);
+    irc_stream_drop(st, n);
+  }
+}
+
+void irc_stream_feed(IrcStream *st, const char *s, size_t len) {
+  // Whole lines go out straight from the caller's buffer; only a partial line
+  // is copied, to wait for the rest of it.
+  if (!st->line.len) {
+    const char *nl;
+    while ((nl = memchr(s, '\n', len))) {
+      size_t n = nl - s;
+      irc_stream_line(st, s, n);
+      s += n + 1;
+      len -= n + 1;
+    }
+  }
+  if (!len)
+    return;
+  txtbuf_cat_mem(&st->line, s, len);
+  irc_stream_drain(st);
+}
+
+void irc_stream_end(IrcStream *st) {
+  irc_stream_line(st, st->line.data, st->line.len);
+  txtbuf_clear(&st->line);
+  const char *note = st->full ? "(.more for the rest, output truncated)" : "(.more for the rest)";
+  if (st->more.len)
+    irc_stream_send(st, note, strlen(note));
+}
+
+void irc_stream_more(IrcStream *st) {
+  if (!st->more.data || !st->more.len)
+    return;
+  TxtBuf held = st->more;
+  st->more = st->line;
+  st->line = held;
+  txtbuf_clear(&st->more);
+  st->sent = 0;
+  irc_stream_drain(st);
+  irc_stream_end(st);
+}
+
+// Takes over the lines src held back, along with where they were going, and
+// leaves src with none.
+void irc_stream_keep(IrcStream *dst, IrcStream *src) {
+  txtbuf_cpy(&dst->prefix, &src->prefix);
+  TxtBuf held = dst->more;
+  dst->more = src->more;
+  src->more = held;
+  txtbuf_clear(&src->more);
+  dst->conn = src->conn;
+}
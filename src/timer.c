@@ -0,0 +1,207 @@
+/*
+** timer.c | Digi's IRC Bot | Timers.
+** https://github.com/davidgarland/digirc
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "digirc.h"
+
+/*
+** A hierarchical timing wheel. Level 0 has a slot per tick and every level
+** above has slots 64 times as wide as the one below, so four levels reach
+** 64^4 ticks (about 46 hours); anything further out parks in the top level
+** and is placed again when that slot comes round. Arming and cancelling are
+** list operations on one slot. A timer only moves down a level when the wheel
+** reaches its slot, so the usual deadline, cancelled long before it is due,
+** costs nothing more than the arm and the cancel.
+**
+** One timerfd drives the whole wheel. It is only ever set for the next tick
+** on which something is due or has to move down a level, never as a
+** periodic tick, so a wheel with nothing due makes no syscalls at all.
+*/
+
+#define TIMER_TICK_MS 10
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+#define TIMER_SPAN ((uint64_t) 1 << (TIMER_BITS * TIMER_LEVELS))
+#define TIMER_NEVER UINT64_MAX
+
+int timer_fd = -1;
+
+// Slot heads are sentinels in circular lists; occupied has a bit per
+// nonempty slot, which is what finding the next due tick works from.
+static Timer wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t occupied[TIMER_LEVELS];
+static uint64_t wheel_now; // The next tick to run.
+static uint64_t wheel_set; // The tick timer_fd is set for, or TIMER_NEVER.
+
+static uint64_t timer_clock_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool timer_is_head(Timer *t) {
+  return (t >= &wheel[0][0]) && (t < &wheel[0][0] + TIMER_LEVELS * TIMER_SLOTS);
+}
+
+static void timer_link(Timer *head, Timer *t) {
+  t->prev = head->prev;
+  t->next = head;
+  head->prev->next = t;
+  head->prev = t;
+}
+
+static void timer_unlink(Timer *t) {
+  Timer *n = t->next;
+  t->prev->next = n;
+  n->prev = t->prev;
+  t->next = t->prev = NULL;
+  // Only a slot head can be left pointing at itself.
+  if ((n->next == n) && timer_is_head(n)) {
+    size_t i = n - &wheel[0][0];
+    occupied[i / TIMER_SLOTS] &= ~((uint64_t) 1 << (i % TIMER_SLOTS));
+  }
+}
+
+static void timer_place(Timer *t) {
+  uint64_t at = t->when;
+  if (at - wheel_now >= TIMER_SPAN)
+    at = wheel_now + TIMER_SPAN - 1;
+  size_t lv = 0;
+  while ((lv < TIMER_LEVELS - 1) && ((at - wheel_now) >> (TIMER_BITS * (lv + 1))))
+    lv++;
+  size_t slot = (at >> (TIMER_BITS * lv)) & (TIMER_SLOTS - 1);
+  timer_link(&wheel[lv][slot], t);
+  occupied[lv] |= (uint64_t) 1 << slot;
+}
+
+// Moves a whole slot onto a list of its own, so callbacks can arm and cancel
+// freely while it is being worked through.
+static void timer_take(size_t lv, size_t slot, Timer *list) {
+  Timer *head = &wheel[lv][slot];
+  *list = (Timer) {list, list, 0, NULL, NULL};
+  if (head->next != head) {
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    head->next = head->prev = head;
+  }
+  occupied[lv] &= ~((uint64_t) 1 << slot);
+}
+
+// The first tick at or after wheel_now that has anything on it. For levels
+// above 0 that is the tick the slot gets spread out over the level below.
+static uint64_t timer_next(void) {
+  uint64_t best = TIMER_NEVER;
+  for (size_t lv = 0; lv < TIMER_LEVELS; lv++) {
+    if (!occupied[lv])
+      continue;
+    unsigned shift = TIMER_BITS * lv;
+    uint64_t cur = (wheel_now + ((uint64_t) 1 << shift) - 1) >> shift;
+    unsigned r = cur & (TIMER_SLOTS - 1);
+    uint64_t rot = (occupied[lv] >> r) | (occupied[lv] << ((TIMER_SLOTS - r) & (TIMER_SLOTS - 1)));
+    uint64_t at = (cur + __builtin_ctzll(rot)) << shift;
+    if (at < best)
+      best = at;
+  }
+  return best;
+}
+
+static void timer_set(uint64_t at) {
+  struct itimerspec its = {0};
+  if (at != TIMER_NEVER) {
+    uint64_t ms = at * TIMER_TICK_MS;
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000;
+  }
+  timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+  io_syscalls++;
+  wheel_set = at;
+}
+
+static void timer_tick(void) {
+  uint64_t t = wheel_now;
+  Timer list;
+  for (size_t lv = TIMER_LEVELS - 1; lv > 0; lv--) {
+    unsigned shift = TIMER_BITS * lv;
+    if (t & (((uint64_t) 1 << shift) - 1))
+      continue;
+    timer_take(lv, (t >> shift) & (TIMER_SLOTS - 1), &list);
+    while (list.next != &list) {
+      Timer *x = list.next;
+      timer_unlink(x);
+      timer_place(x);
+    }
+  }
+
+  timer_take(0, t & (TIMER_SLOTS - 1), &list);
+  wheel_now = t + 1;
+  while (list.next != &list) {
+    Timer *x = list.next;
+    timer_unlink(x);
+    x->fn(x);
+  }
+}
+
+bool timer_init(void) {
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd < 0)
+    return false;
+  for (size_t lv = 0; lv < TIMER_LEVELS; lv++)
+    for (size_t i = 0; i < TIMER_SLOTS; i++)
+      wheel[lv][i].next = wheel[lv][i].prev = &wheel[lv][i];
+  wheel_now = timer_clock_ms() / TIMER_TICK_MS;
+  wheel_set = TIMER_NEVER;
+  return true;
+}
+
+bool timer_armed(Timer *t) {
+  return t->next;
+}
+
+void timer_arm(Timer *t, uint64_t ms) {
+  if (t->next)
+    timer_unlink(t);
+  uint64_t now_ms = timer_clock_ms();
+  uint64_t now = now_ms / TIMER_TICK_MS;
+  // An empty wheel has nothing to lose by skipping the ticks it slept through.
+  if (!(occupied[0] | occupied[1] | occupied[2] | occupied[3]) && (now > wheel_now))
+    wheel_now = now;
+  // Rounded up, so that a timer never fires early.
+  t->when = (now_ms + ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  if (t->when < wheel_now)
+    t->when = wheel_now;
+  timer_place(t);
+  // Later deadlines leave the timerfd alone; it wakes early and is set again.
+  // Moving a slot down a level can wait until then, as nothing in it is due.
+  if (t->when < wheel_set)
+    timer_set(t->when);
+}
+
+void timer_cancel(Timer *t) {
+  if (t->next)
+    timer_unlink(t);
+}
+
+// Runs everything that is due. Call it whenever timer_fd is readable.
+void timer_run(void) {
+  uint64_t now = timer_clock_ms() / TIMER_TICK_MS;
+  if (wheel_set <= now)
+    wheel_set = TIMER_NEVER; // It has fired, which disarms it.
+  uint64_t at;
+  while ((at = timer_next()) <= now) {
+    wheel_now = at;
+    timer_tick();
+  }
+  if (wheel_now <= now)
+    wheel_now = now + 1;
+  at = timer_next();
+  if (at != wheel_set)
+    timer_set(at);
+}